@@ -0,0 +1,148 @@
+// buttons.c - debouncing of the buttons and a queue of press/release/hold events
+//
+// All buttons are debounced at once in a packed word with a vertical counter:
+// bit n of btn_ct0 and btn_ct1 form a 2-bit counter for button n, which counts
+// the packets in a row its level differs from the debounced state. After 4 of
+// them the debounced state flips. Each packet costs the same few bit-operations,
+// no matter how many buttons change.
+//
+// btn_update() is meant to be called for every packet from sw_data_is_now_valid(),
+// so short presses are seen even while the main loop is busy.
+
+
+
+// the buttons, SW_BTN_* bits of sw_state_t.btns
+#define BTN_ALL 0x01FF
+
+// the device sends a pressed button as 0
+#define BTN_ACTIVE_LOW 1
+
+// time a set of buttons has to stay pressed to report a hold, in ticks
+#define BTN_HOLD_CT SW_US_TO_TICKS(500000UL)
+
+// the events
+#define BTN_EVENT_PRESS 0
+#define BTN_EVENT_RELEASE 1
+#define BTN_EVENT_HOLD 2
+
+// an event, all buttons which changed with the same packet share one
+typedef struct
+{
+	// BTN_EVENT_*
+	uint8_t type;
+
+	// SW_BTN_* bits of the buttons
+	uint16_t btns;
+
+	// capture time of the packet, in timer-ticks of 0.5us (see sw_now())
+	uint32_t time;
+} btn_event_t;
+
+// queue of events, written from interrupt-context and read by btn_get_event()
+#define BTN_QUEUE_SIZE 8
+volatile btn_event_t btn_queue[BTN_QUEUE_SIZE]; // 56 bytes ram
+volatile uint8_t btn_queue_head = 0;            // 1 byte ram
+volatile uint8_t btn_queue_tail = 0;            // 1 byte ram
+volatile uint16_t btn_queue_overflows = 0;      // 2 bytes ram
+
+// debounced state, a set bit is a pressed button
+volatile uint16_t btn_state = 0;                // 2 bytes ram
+
+// vertical counter
+uint16_t btn_ct0 = 0xFFFF;                      // 2 bytes ram
+uint16_t btn_ct1 = 0xFFFF;                      // 2 bytes ram
+
+// time the debounced state last changed, set when the hold has been reported
+uint32_t btn_since = 0;                         // 4 bytes ram
+uint8_t btn_held = 0;                           // 1 byte ram
+
+
+
+
+
+// append an event to the queue, drop it if the queue is full
+static void btn_queue_push(uint8_t type, uint16_t btns, uint32_t time)
+{
+	uint8_t head = btn_queue_head;
+
+	if((uint8_t)(head - btn_queue_tail) >= BTN_QUEUE_SIZE)
+	{
+		btn_queue_overflows++;
+		return;
+	}
+
+	volatile btn_event_t *ev = &btn_queue[head % BTN_QUEUE_SIZE];
+	ev->type = type;
+	ev->btns = btns;
+	ev->time = time;
+
+	btn_queue_head = head + 1;
+}
+
+// feed the buttons of a packet and its capture time
+void btn_update(uint16_t btns, uint32_t time)
+{
+#if BTN_ACTIVE_LOW
+	btns = ~btns & BTN_ALL;
+#else
+	btns &= BTN_ALL;
+#endif
+
+	// buttons whose level differs from the debounced state,
+	// the counters of all others are reset
+	uint16_t i = btn_state ^ btns;
+	btn_ct0 = ~(btn_ct0 & i);
+	btn_ct1 = btn_ct0 ^ (btn_ct1 & i);
+
+	// buttons whose counter ran out flip
+	i &= btn_ct0 & btn_ct1;
+
+	if(i)
+	{
+		uint16_t state = btn_state ^ i;
+		btn_state = state;
+
+		if(i & state)
+			btn_queue_push(BTN_EVENT_PRESS, i & state, time);
+
+		if(i & ~state)
+			btn_queue_push(BTN_EVENT_RELEASE, i & ~state, time);
+
+		btn_since = time;
+		btn_held = 0;
+	}
+
+	// the same buttons pressed for BTN_HOLD_CT
+	else if(!btn_held && btn_state && time - btn_since >= BTN_HOLD_CT)
+	{
+		btn_queue_push(BTN_EVENT_HOLD, btn_state, time);
+		btn_held = 1;
+	}
+}
+
+// take the oldest event from the queue
+// returns 0 if there is none
+uint8_t btn_get_event(btn_event_t *ev)
+{
+	uint8_t tail = btn_queue_tail;
+
+	if(tail == btn_queue_head)
+		return 0;
+
+	*ev = btn_queue[tail % BTN_QUEUE_SIZE];
+	btn_queue_tail = tail + 1;
+
+	return 1;
+}
+
+// debounced state of the buttons, a set bit is a pressed button
+uint16_t btn_pressed(void)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	uint16_t state = btn_state;
+
+	SREG = sreg_tmp;
+	return state;
+}
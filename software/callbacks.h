@@ -1,2 +1 @@
-void sw_data_is_now_invalid(void);
 void sw_data_is_now_valid(void);
@@ -7,9 +7,12 @@
 #include "bits.h"
 #include "callbacks.h"
 
+// sidewinder.c comes first, it may bind global variables to registers
+#include "sidewinder.c"
+#include "stick.c"
+#include "buttons.c"
 #include "ks0108.c"
 #include "uart.c"
-#include "sidewinder.c"
 
 #define INDI_DDR DDRB
 #define INDI_PORT PORTB
@@ -19,36 +22,156 @@
 #define LCD_INDI_PORT PORTH
 #define LCD_INDI_P PH5
 
-volatile uint8_t is_data_valid = 0;
-
-void sw_data_is_now_invalid(void)
-{
-	is_data_valid = 0;
-}
-
 void sw_data_is_now_valid(void)
 {
-	if(sw_dta.btn_fire)
+	volatile sw_packet_t *pkt = sw_last_packet();
+
+	// debounce the buttons of every packet, while it's still fresh
+	btn_update(pkt->state.btns, pkt->time);
+
+	if(pkt->state.btns & SW_BTN_FIRE)
 		CLEARBIT(INDI_PORT, INDI_P);
 	else
 		SETBIT(INDI_PORT, INDI_P);
-
-	is_data_valid = 1;
 }
 
 
-#define XY_SZ 5
+#if SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+// print the statistics of the protocol-analyzer to the uart, one line of
+// key=value pairs. All times are in ticks of 62.5ns
+void sw_an_dump(void)
+{
+	sw_an_stats_t st;
+	sw_an_get_stats(&st);
+
+	uart_puts_p(PSTR("packets="));
+	uart_puts_uint16(st.packets);
+
+	if(st.period_cnt > 0)
+	{
+		uint16_t mean = st.period_sum / st.period_cnt;
+
+		uart_puts_p(PSTR(" period_min="));
+		uart_puts_uint16(st.period_min);
+		uart_puts_p(PSTR(" period_max="));
+		uart_puts_uint16(st.period_max);
+		uart_puts_p(PSTR(" period_mean="));
+		uart_puts_uint16(mean);
+		uart_puts_p(PSTR(" jitter="));
+		uart_puts_uint16(st.period_max - st.period_min);
+
+		// one bit per period
+		uart_puts_p(PSTR(" clock_hz="));
+		uart_puts_uint32(F_CPU / mean);
+	}
+
+	if(st.gap_max > 0)
+	{
+		uart_puts_p(PSTR(" gap_last="));
+		uart_puts_uint32(st.gap_last);
+		uart_puts_p(PSTR(" gap_min="));
+		uart_puts_uint32(st.gap_min);
+		uart_puts_p(PSTR(" gap_max="));
+		uart_puts_uint32(st.gap_max);
+	}
+
+	// commands and port writes the display driver did not have to send
+	uint8_t sreg_tmp = SREG;
+	cli();
+	uint32_t elided = ks0108Elided;
+	SREG = sreg_tmp;
 
+	uart_puts_p(PSTR(" lcd_elided="));
+	uart_puts_uint32(elided);
 
-void ks0108DrawPixmap8P(uint8_t x, const uint8_t y, uint8_t count, const uint8_t *pixels)
+	uart_puts_p(PSTR("\r\n"));
+}
+
+#if KS0108_FRAMEBUFFER
+// write the whole display a few times and print the rate of the display's
+// bus to the uart, the screen is left as it was
+void lcd_bench(void)
 {
-	pixels += count;
-	while(count-- > 0)
+	uint32_t ticks = 0;
+
+	for(uint8_t i = 0; i < 2; i++)
 	{
-		ks0108GotoXY(x++, y);
-		ks0108WriteData(pgm_read_byte(--pixels));
+		ks0108InvertRect(0, 0, 127, 63);
+
+		uint32_t start = sw_now();
+		ks0108Flush();
+		ticks += sw_now() - start;
 	}
+
+	uart_puts_p(PSTR("lcd_bytes_per_s="));
+	uart_puts_uint32(2UL * LCD_PAGES * LCD_W * SW_US_TO_TICKS(1000000UL) / ticks);
+	uart_puts_p(PSTR("\r\n"));
 }
+#endif
+#endif
+
+
+#define XY_SZ 5
+
+// calibration of the axes in raw units as sent by the device: the values at
+// both end-stops and at the center, and the deadzone around the center.
+// The raw range is scaled to the display separately on each side of the center
+#define CAL_X_MIN 0
+#define CAL_X_CTR 512
+#define CAL_X_MAX 1023
+#define CAL_X_DZ 0
+
+#define CAL_Y_MIN 0
+#define CAL_Y_CTR 512
+#define CAL_Y_MAX 1023
+#define CAL_Y_DZ 0
+
+#define CAL_M_MIN 0
+#define CAL_M_CTR 64
+#define CAL_M_MAX 127
+#define CAL_M_DZ 0
+
+#define CAL_R_MIN 0
+#define CAL_R_CTR 32
+#define CAL_R_MAX 63
+#define CAL_R_DZ 0
+
+// number of pixels the widgets move over
+#define XY_RANGE (62 - XY_SZ)
+#define M_RANGE 62
+#define R_RANGE 48
+
+// rounded division
+#define CAL_DIV(a, b) (((a) + (b) / 2) / (b))
+
+// map a raw value v to 0..out with a calibration, a constant expression
+#define CAL_MAP(v, min, ctr, max, dz, out) \
+	((v) <= (min) ? 0 : \
+	(v) >= (max) ? (out) : \
+	(v) < (ctr) - (dz) ? (uint8_t)(CAL_DIV((uint32_t)((v) - (min)) * ((out) / 2), (ctr) - (dz) - (min))) : \
+	(v) > (ctr) + (dz) ? (uint8_t)((out) - CAL_DIV((uint32_t)((max) - (v)) * ((out) - (out) / 2), (max) - (ctr) - (dz))) : \
+	(out) / 2)
+
+// expand f(i) for n consecutive values of i, used to generate the tables below
+#define LUT_4(f, i) f(i) f((i) + 1) f((i) + 2) f((i) + 3)
+#define LUT_16(f, i) LUT_4(f, i) LUT_4(f, (i) + 4) LUT_4(f, (i) + 8) LUT_4(f, (i) + 12)
+#define LUT_64(f, i) LUT_16(f, i) LUT_16(f, (i) + 16) LUT_16(f, (i) + 32) LUT_16(f, (i) + 48)
+#define LUT_128(f, i) LUT_64(f, i) LUT_64(f, (i) + 64)
+#define LUT_256(f, i) LUT_128(f, i) LUT_128(f, (i) + 128)
+
+// display coordinates of the raw values, computed by the compiler so drawing
+// a frame needs no multiplication or division. x and y are looked up by their
+// upper 8 bits, the middle of each group of 4 raw values is mapped
+#define LUT_X(i) (1 + XY_RANGE - CAL_MAP((i) * 4 + 2, CAL_X_MIN, CAL_X_CTR, CAL_X_MAX, CAL_X_DZ, XY_RANGE)),
+#define LUT_Y(i) (1 + XY_RANGE - CAL_MAP((i) * 4 + 2, CAL_Y_MIN, CAL_Y_CTR, CAL_Y_MAX, CAL_Y_DZ, XY_RANGE)),
+#define LUT_M(i) (M_RANGE - CAL_MAP(i, CAL_M_MIN, CAL_M_CTR, CAL_M_MAX, CAL_M_DZ, M_RANGE)),
+#define LUT_R(i) (CAL_MAP(i, CAL_R_MIN, CAL_R_CTR, CAL_R_MAX, CAL_R_DZ, R_RANGE)),
+
+static const PROGMEM uint8_t x_tab[256] = { LUT_256(LUT_X, 0) };
+static const PROGMEM uint8_t y_tab[256] = { LUT_256(LUT_Y, 0) };
+static const PROGMEM uint8_t m_tab[128] = { LUT_128(LUT_M, 0) };
+static const PROGMEM uint8_t r_tab[64] = { LUT_64(LUT_R, 0) };
+
 
 int __attribute__((OS_main))
 main(void)
@@ -56,17 +179,24 @@ main(void)
 	// setup sidewinder device communication
 	sw_setup();
 
+#if SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	// the analyzer dumps its statistics to the uart
+	uart_setup();
+	uint32_t last_dump = 0;
+#endif
+
 	// initialize display
 	ks0108Init(0);
 	_delay_ms(1000);
 
-	static const PROGMEM uint8_t lArrow[3] = {0b00100, 0b01010, 0b10001};
-	static const PROGMEM uint8_t rArrow[3] = {0b10001, 0b01010, 0b00100};
+	// sprites of 8 rows, one byte per column from left to right
+	static const PROGMEM uint8_t lArrow[3] = {0b10001, 0b01010, 0b00100};
+	static const PROGMEM uint8_t rArrow[3] = {0b00100, 0b01010, 0b10001};
 	static const PROGMEM uint8_t tArrow[5] = {0b1000010, 0b1000100, 0b1001000, 0b1000100, 0b1000010};
 	static const PROGMEM uint8_t bArrow[5] = {0b0100, 0b0010, 0b0001, 0b0010, 0b0100};
 
-	static const PROGMEM uint8_t lArrowOn[3] = {0b00100, 0b01110, 0b11111};
-	static const PROGMEM uint8_t rArrowOn[3] = {0b11111, 0b01110, 0b00100};
+	static const PROGMEM uint8_t lArrowOn[3] = {0b11111, 0b01110, 0b00100};
+	static const PROGMEM uint8_t rArrowOn[3] = {0b00100, 0b01110, 0b11111};
 	static const PROGMEM uint8_t tArrowOn[5] = {0b1000010, 0b1000110, 0b1001110, 0b1000110, 0b1000010};
 	static const PROGMEM uint8_t bArrowOn[5] = {0b0100, 0b0110, 0b0111, 0b0110, 0b0100};
 
@@ -90,10 +220,10 @@ main(void)
 	ks0108DrawRect(118,  8,  9,  9, BLACK); // d-btn
 
 	// arrows
-	ks0108DrawPixmap8P( 92, 40, 3, rArrow);
-	ks0108DrawPixmap8P(108, 40, 3, lArrow);
-	ks0108DrawPixmap8P( 99, 48, 5, tArrow);
-	ks0108DrawPixmap8P( 99, 32, 5, bArrow);
+	ks0108DrawSprite_P( 92, 40, 3, 8, rArrow, NULL);
+	ks0108DrawSprite_P(108, 40, 3, 8, lArrow, NULL);
+	ks0108DrawSprite_P( 99, 48, 5, 8, tArrow, NULL);
+	ks0108DrawSprite_P( 99, 32, 5, 8, bArrow, NULL);
 
 	// led connected to that indicator as output
 	SETBIT(INDI_DDR, INDI_P);
@@ -102,25 +232,48 @@ main(void)
 	// enable interrupts
 	sei();
 
-	sw_data_t last_dta = sw_dta;
+#if SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER && KS0108_FRAMEBUFFER
+	lcd_bench();
+#endif
+
+	sw_data_t last_dta = sw_data_empty;
+	sw_packet_t pkts[4];
 
 	while(1)
 	{
-		if(is_data_valid)
+#if SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+		// once per second
+		if(sw_now() - last_dump >= SW_US_TO_TICKS(1000000UL))
 		{
-			uint8_t sreg_tmp = SREG;
-			cli();
+			last_dump = sw_now();
+			sw_an_dump();
+		}
+#endif
 
-			sw_data_t c_dta = sw_dta;
+		// drain the packets received since the last redraw in batches,
+		// the display only needs to show the newest one
+		uint8_t n = sw_ring_read(pkts, 4);
 
-			SREG = sreg_tmp;
+		// only port 0 is shown if several are read
+		while(n > 0 && pkts[n-1].port != 0)
+			n--;
+
+		if(n > 0)
+		{
+			sw_data_t c_dta = pkts[n-1].data;
 
-			if(last_dta.x != c_dta.x || last_dta.y != c_dta.y)
+			// fields which changed since the last redraw
+			uint16_t chg = sw_diff(&last_dta, &c_dta);
+
+			// the decoded fields to draw
+			sw_state_t st = pkts[n-1].state;
+
+			if(chg & (SW_CHG_X | SW_CHG_Y))
 			{
 				// x & y display coords
 				uint8_t
-					x = (((1024 - (uint16_t)c_dta.x) * (62-XY_SZ)) / 1024) + 1,
-					y = (((1024 - (uint16_t)c_dta.y) * (62-XY_SZ)) / 1024) + 1;
+					x = pgm_read_byte(&x_tab[st.x >> 2]),
+					y = pgm_read_byte(&y_tab[st.y >> 2]);
 
 				// clear right half of screen
 				if(x > 1)
@@ -151,11 +304,11 @@ main(void)
 
 
 
-			if(last_dta.m != c_dta.m)
+			if(chg & SW_CHG_M)
 			{
 				// movable-member
 				uint8_t
-					m = (((128 - (uint16_t)c_dta.m) * 62) / 128);
+					m = pgm_read_byte(&m_tab[st.m]);
 
 				// clear movable-member bar
 				if(m < 62)
@@ -170,11 +323,11 @@ main(void)
 
 
 
-			if(last_dta.r != c_dta.r)
+			if(chg & SW_CHG_R)
 			{
 				// rotation
 				uint8_t
-					r = ((((uint16_t)c_dta.r) * 49) / 64);
+					r = pgm_read_byte(&r_tab[st.r]);
 
 				// clear rotation bar
 				ks0108FillRect(77, 1, 49, 3, WHITE);
@@ -186,49 +339,59 @@ main(void)
 			}
 
 			// arrows
-			if(last_dta.head != c_dta.head)
+			if(chg & SW_CHG_HEAD)
 			{
-				ks0108DrawPixmap8P( 92, 40, 3, (c_dta.head >= 2 && c_dta.head <= 4) ? rArrowOn : rArrow);
-				ks0108DrawPixmap8P(108, 40, 3, (c_dta.head >= 6 && c_dta.head <= 8) ? lArrowOn : lArrow);
-				ks0108DrawPixmap8P( 99, 48, 5, ((c_dta.head >= 1 && c_dta.head <= 2) || c_dta.head == 8) ? tArrowOn : tArrow);
-				ks0108DrawPixmap8P( 99, 32, 5, (c_dta.head >= 4 && c_dta.head <= 6) ? bArrowOn : bArrow);
+				uint8_t dir = sw_hat_dir(st.hat);
+
+				ks0108DrawSprite_P( 92, 40, 3, 8, (dir & SW_DIR_RIGHT) ? rArrowOn : rArrow, NULL);
+				ks0108DrawSprite_P(108, 40, 3, 8, (dir & SW_DIR_LEFT) ? lArrowOn : lArrow, NULL);
+				ks0108DrawSprite_P( 99, 48, 5, 8, (dir & SW_DIR_UP) ? tArrowOn : tArrow, NULL);
+				ks0108DrawSprite_P( 99, 32, 5, 8, (dir & SW_DIR_DOWN) ? bArrowOn : bArrow, NULL);
 			}
 
 
 			// fire btn
-			if(last_dta.btn_fire != c_dta.btn_fire)
-				ks0108FillRect( 77, 55, 49,  7, c_dta.btn_fire ? WHITE : BLACK);
+			if(chg & SW_CHG_FIRE)
+				ks0108FillRect( 77, 55, 49,  7, (st.btns & SW_BTN_FIRE) ? WHITE : BLACK);
 
 
 			// head-up-btn
-			if(last_dta.btn_top_up != c_dta.btn_top_up)
-				ks0108FillRect( 77, 44,  7,  7, c_dta.btn_top_up ? WHITE : BLACK);
+			if(chg & SW_CHG_TOP_UP)
+				ks0108FillRect( 77, 44,  7,  7, (st.btns & SW_BTN_TOP_UP) ? WHITE : BLACK);
 
 			// head-down-btn
-			if(last_dta.btn_top_down != c_dta.btn_top_down)
-				ks0108FillRect( 77, 33,  7,  7, c_dta.btn_top_down ? WHITE : BLACK);
+			if(chg & SW_CHG_TOP_DOWN)
+				ks0108FillRect( 77, 33,  7,  7, (st.btns & SW_BTN_TOP_DOWN) ? WHITE : BLACK);
 
 			// head-up-btn
-			if(last_dta.btn_top != c_dta.btn_top)
-				ks0108FillRect(119, 33,  7, 18, c_dta.btn_top ? WHITE : BLACK);
+			if(chg & SW_CHG_TOP)
+				ks0108FillRect(119, 33,  7, 18, (st.btns & SW_BTN_TOP) ? WHITE : BLACK);
 
 			// shift-btn
-			if(last_dta.btn_shift != c_dta.btn_shift)
-				ks0108FillRect( 77,  9,  7, 18, c_dta.btn_shift ? WHITE : BLACK);
+			if(chg & SW_CHG_SHIFT)
+				ks0108FillRect( 77,  9,  7, 18, (st.btns & SW_BTN_SHIFT) ? WHITE : BLACK);
 
 			// [a-d]-btn
-			//if(last_dta.btn_a != c_dta.btn_a)
-				ks0108FillRect(108,  9,  7,  7, c_dta.btn_a ? WHITE : BLACK);
-			//if(last_dta.btn_b != c_dta.btn_b)
-				ks0108FillRect(102, 20,  7,  7, c_dta.btn_b ? WHITE : BLACK);
-			//if(last_dta.btn_c != c_dta.btn_c)
-				ks0108FillRect(113, 20,  7,  7, c_dta.btn_c ? WHITE : BLACK);
-			//if(last_dta.btn_d != c_dta.btn_d)
-				ks0108FillRect(119,  9,  7,  7, c_dta.btn_d ? WHITE : BLACK);
+			if(chg & SW_CHG_A)
+				ks0108FillRect(108,  9,  7,  7, (st.btns & SW_BTN_A) ? WHITE : BLACK);
+			if(chg & SW_CHG_B)
+				ks0108FillRect(102, 20,  7,  7, (st.btns & SW_BTN_B) ? WHITE : BLACK);
+			if(chg & SW_CHG_C)
+				ks0108FillRect(113, 20,  7,  7, (st.btns & SW_BTN_C) ? WHITE : BLACK);
+			if(chg & SW_CHG_D)
+				ks0108FillRect(119,  9,  7,  7, (st.btns & SW_BTN_D) ? WHITE : BLACK);
 
 			TOGGLEBIT(LCD_INDI_PORT, LCD_INDI_P);
 			last_dta = c_dta;
 		}
+
+#if KS0108_ASYNC_FLUSH
+		// write what changed to the display in the background
+		ks0108FlushAsync();
+#elif KS0108_FRAMEBUFFER
+		// write what changed to the display
+		ks0108Flush();
+#endif
 	}
 	return 0;
 }
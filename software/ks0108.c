@@ -12,16 +12,70 @@
 #include <avr/io.h>
 #include <avr/pgmspace.h>
 #include "ks0108.h"
+#if KS0108_ASYNC_FLUSH
+#include <avr/interrupt.h>
+#endif
+
+// cycles of F_CPU for a time in ns, rounded up
+#define KS0108_NS_TO_CYCLES(ns)		(((uint32_t)(ns) * (F_CPU / 1000UL) + 999999UL) / 1000000UL)
+
+// cycles left to wait for a time in ns, if the instructions around the wait take
+// overhead cycles of it anyway
+#define KS0108_WAIT_CYCLES(ns, overhead)	\
+	(KS0108_NS_TO_CYCLES(ns) > (overhead) ? KS0108_NS_TO_CYCLES(ns) - (overhead) : 0)
+
+// source of the bytes of a column run
+#define KS0108_SRC_RAM				0
+#define KS0108_SRC_PGM				1
+#define KS0108_SRC_FILL				2			// the same byte for every column
+
+static void ks0108Blit(uint8_t x, uint8_t y, uint8_t width, uint8_t height, const uint8_t *sprite, const uint8_t *mask, uint8_t src);
+static void ks0108AccDot(uint8_t x, uint8_t y, uint8_t color);
+static void ks0108AccFlush(void);
 
 lcdCoord			ks0108Coord;
 uint8_t				ks0108Inverted=0;
 ks0108FontCallback	ks0108FontRead;
 uint8_t				ks0108FontColor;
 const uint8_t*		ks0108Font;
+uint8_t				ks0108FontHeight;				// header of the selected font
+uint8_t				ks0108FontBands;				// pages a glyph takes
+uint8_t				ks0108FontFirst;
+uint8_t				ks0108FontCount;
+uint16_t			ks0108FontIndex[KS0108_FONT_INDEX];	// columns of all glyphs before each one
+
+// shadow copies of the column and page register of each chip, 0xFF if unknown.
+// Commands setting a register to the value it already has are not sent, and
+// neither are writes to the command port which change nothing.
+uint8_t				ks0108ShadowAddr[2] = {0xFF, 0xFF};
+uint8_t				ks0108ShadowPage[2] = {0xFF, 0xFF};
+uint32_t			ks0108Elided = 0;				// number of commands and port writes not sent
+
+// dots of a line or circle collected in one display byte, written together
+uint8_t				ks0108AccX;
+uint8_t				ks0108AccPage = 0xFF;			// 0xFF if no dots are collected
+uint8_t				ks0108AccBits;
+uint8_t				ks0108AccColor;
+
+#if KS0108_FRAMEBUFFER
+uint8_t				ks0108Buffer[LCD_PAGES][LCD_W];	// copy of the display
+uint8_t				ks0108DirtyMin[LCD_PAGES];		// first changed column of each page
+uint8_t				ks0108DirtyMax[LCD_PAGES];		// last changed column, < min if unchanged
+#endif
+
+#if KS0108_ASYNC_FLUSH
+uint8_t				ks0108FlushMin[LCD_PAGES];		// columns taken by the running flush
+uint8_t				ks0108FlushMax[LCD_PAGES];
+uint8_t				ks0108FlushPage;				// page and column written next
+uint8_t				ks0108FlushX;
+uint8_t				ks0108FlushAddr;				// the address has to be set before the next byte
+uint8_t				ks0108FlushFirst;				// page the next flush starts taking columns from
+volatile uint8_t	ks0108FlushDone = 1;			// no flush running
+#endif
 
 void ks0108DrawLine(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint8_t color) {
-	uint8_t length, i, y, yAlt, xTmp, yTmp;
-	int16_t m;
+	uint8_t xTmp, yTmp;
+	int16_t dx, dy, err, e2;
 	
 	//
 	// vertical line
@@ -51,73 +105,27 @@ void ks0108DrawLine(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint8_t colo
 	// schiefe line :)
 	//
 	} else {
-		// angle >= 45
-		if((y2-y1) >= (x2-x1) || (y1-y2) >= (x2-x1)) {
-			// x1 must be smaller than x2
-			if(x1 > x2) {
-				xTmp = x1;
-				yTmp = y1;
-				x1 = x2;
-				y1 = y2;
-				x2 = xTmp;
-				y2 = yTmp;
-			}
+		// bresenham, the dots come byte by byte and each byte is written once
+		dx = x2 > x1 ? x2-x1 : x1-x2;
+		dy = y2 > y1 ? y1-y2 : y2-y1;
+		err = dx+dy;
 		
-			length = x2-x1;		// not really the length :)
-			m = ((y2-y1)*200)/length;
-			yAlt = y1;
+		while(1) {
+			ks0108AccDot(x1, y1, color);
+			if(x1 == x2 && y1 == y2)
+				break;
 			
-			for(i=0; i<=length; i++) {
-				y = ((m*i)/200)+y1;
-				
-				if((m*i)%200 >= 100)
-					y++;
-				else if((m*i)%200 <= -100)
-					y--;
-				
-				ks0108DrawLine(x1+i, yAlt, x1+i, y, color);
-				
-				if(length <= (y2-y1) && y1 < y2)
-					yAlt = y+1;
-				else if(length <= (y1-y2) && y1 > y2)
-					yAlt = y-1;
-				else
-					yAlt = y;
-			}
-		
-		// angle < 45
-		} else {
-			// y1 must be smaller than y2
-			if(y1 > y2) {
-				xTmp = x1;
-				yTmp = y1;
-				x1 = x2;
-				y1 = y2;
-				x2 = xTmp;
-				y2 = yTmp;
+			e2 = 2*err;
+			if(e2 >= dy) {
+				err += dy;
+				x1 += x1 < x2 ? 1 : -1;
 			}
-			
-			length = y2-y1;
-			m = ((x2-x1)*200)/length;
-			yAlt = x1;
-			
-			for(i=0; i<=length; i++) {
-				y = ((m*i)/200)+x1;
-				
-				if((m*i)%200 >= 100)
-					y++;
-				else if((m*i)%200 <= -100)
-					y--;
-				
-				ks0108DrawLine(yAlt, y1+i, y, y1+i, color);
-				if(length <= (x2-x1) && x1 < x2)
-					yAlt = y+1;
-				else if(length <= (x1-x2) && x1 > x2)
-					yAlt = y-1;
-				else
-					yAlt = y;
+			if(e2 <= dx) {
+				err += dx;
+				y1 += y1 < y2 ? 1 : -1;
 			}
 		}
+		ks0108AccFlush();
 	}
 }
 
@@ -128,22 +136,18 @@ void ks0108DrawRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t
 	ks0108DrawVertLine(x+width, y, height, color);		// right
 }
 
-void ks0108DrawRoundRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t radius, uint8_t color) {
+// one octant of a circle around cx|cy. The dots of an octant come byte by byte,
+// so each byte is written once. sx and sy are the directions of x1 and y1,
+// swap exchanges x1 and y1
+static void ks0108DrawArc(uint8_t cx, uint8_t cy, uint8_t radius, int8_t sx, int8_t sy, uint8_t swap, uint8_t color) {
   	int16_t tSwitch, x1 = 0, y1 = radius;
   	tSwitch = 3 - 2 * radius;
 	
 	while (x1 <= y1) {
-	    ks0108SetDot(x+radius - x1, y+radius - y1, color);
-	    ks0108SetDot(x+radius - y1, y+radius - x1, color);
-
-	    ks0108SetDot(x+width-radius + x1, y+radius - y1, color);
-	    ks0108SetDot(x+width-radius + y1, y+radius - x1, color);
-	    
-	    ks0108SetDot(x+width-radius + x1, y+height-radius + y1, color);
-	    ks0108SetDot(x+width-radius + y1, y+height-radius + x1, color);
-
-	    ks0108SetDot(x+radius - x1, y+height-radius + y1, color);
-	    ks0108SetDot(x+radius - y1, y+height-radius + x1, color);
+		if(swap)
+			ks0108AccDot(cx + sx*y1, cy + sy*x1, color);
+		else
+			ks0108AccDot(cx + sx*x1, cy + sy*y1, color);
 
 	    if (tSwitch < 0) {
 	    	tSwitch += (4 * x1 + 6);
@@ -153,6 +157,21 @@ void ks0108DrawRoundRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, ui
 	    }
 	    x1++;
 	}
+	ks0108AccFlush();
+}
+
+void ks0108DrawRoundRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t radius, uint8_t color) {
+	ks0108DrawArc(x+radius, y+radius, radius, -1, -1, 0, color);
+	ks0108DrawArc(x+radius, y+radius, radius, -1, -1, 1, color);
+	
+	ks0108DrawArc(x+width-radius, y+radius, radius, 1, -1, 0, color);
+	ks0108DrawArc(x+width-radius, y+radius, radius, 1, -1, 1, color);
+	
+	ks0108DrawArc(x+width-radius, y+height-radius, radius, 1, 1, 0, color);
+	ks0108DrawArc(x+width-radius, y+height-radius, radius, 1, 1, 1, color);
+	
+	ks0108DrawArc(x+radius, y+height-radius, radius, -1, 1, 0, color);
+	ks0108DrawArc(x+radius, y+height-radius, radius, -1, 1, 1, color);
 	  	
 	ks0108DrawHoriLine(x+radius, y, width-(2*radius), color);			// top
 	ks0108DrawHoriLine(x+radius, y+height, width-(2*radius), color);	// bottom
@@ -163,6 +182,92 @@ void ks0108DrawRoundRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, ui
 /*
  * Hardware-Functions 
  */
+static inline uint8_t ks0108ChipBits(uint8_t chip) {
+	return chip == CHIP1 ? (0x01 << CSEL1) : (0x01 << CSEL2);
+}
+
+// set chip select, D/I and R/W at once, the port itself is the shadow copy
+static inline void ks0108SetCtrl(uint8_t bits) {
+	uint8_t port = (LCD_CMD_PORT & ~LCD_CTRL_MASK) | bits;
+	
+	if(port != LCD_CMD_PORT)
+		LCD_CMD_PORT = port;
+	else
+		ks0108Elided++;
+}
+
+// the chip incremented its column register after a data read or write
+static inline void ks0108AddrInc(uint8_t chip) {
+	if(ks0108ShadowAddr[chip] != 0xFF)
+		ks0108ShadowAddr[chip] = (ks0108ShadowAddr[chip]+1) & 0x3F;
+}
+
+#if KS0108_FRAMEBUFFER
+static inline void ks0108MarkDirty(uint8_t page, uint8_t x1, uint8_t x2) {
+	if(x1 < ks0108DirtyMin[page])
+		ks0108DirtyMin[page] = x1;
+	if(x2 > ks0108DirtyMax[page])
+		ks0108DirtyMax[page] = x2;
+}
+
+// clear the pixels of the rect if clear is 0xFF, then toggle them if toggle is 0xFF
+static void ks0108BufferRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t clear, uint8_t toggle) {
+	uint8_t page, lastPage, mask, i, *data;
+	
+	if(x >= LCD_W || y >= LCD_H)
+		return;
+	if(width >= LCD_W-x)							// clip to the display
+		width = LCD_W-1-x;
+	if(height >= LCD_H-y)
+		height = LCD_H-1-y;
+	
+	lastPage = (y+height)/8;
+	for(page = y/8; page <= lastPage; page++) {
+		mask = 0xFF;
+		if(page == y/8)
+			mask <<= y%8;							// first page
+		if(page == lastPage)
+			mask &= 0xFF >> (7-(y+height)%8);		// last page
+		
+		data = &ks0108Buffer[page][x];
+		for(i=0; i<=width; i++) {
+			*data = (*data & ~(mask & clear)) ^ (mask & toggle);
+			data++;
+		}
+		
+		ks0108MarkDirty(page, x, x+width);
+	}
+}
+
+void ks0108FillRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t color) {
+	ks0108BufferRect(x, y, width, height, 0xFF, color);
+}
+
+void ks0108InvertRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height) {
+	ks0108BufferRect(x, y, width, height, 0x00, 0xFF);
+}
+
+void ks0108SetInverted(uint8_t invert) {
+	// the buffer stays as it is, ks0108Flush() inverts while writing
+	if(ks0108Inverted != invert) {
+		ks0108Inverted = invert;
+		for(uint8_t page=0; page<LCD_PAGES; page++)
+			ks0108MarkDirty(page, 0, LCD_W-1);
+	}
+}
+
+void ks0108SetDot(uint8_t x, uint8_t y, uint8_t color) {
+	if(x >= LCD_W || y >= LCD_H)
+		return;
+	
+	if(color == BLACK) {
+		ks0108Buffer[y/8][x] |= 0x01 << (y%8);		// set dot
+	} else {
+		ks0108Buffer[y/8][x] &= ~(0x01 << (y%8));	// clear dot
+	}
+	ks0108MarkDirty(y/8, x, x);
+}
+#else
 void ks0108FillRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t color) {
 	uint8_t mask, pageOffset, h, i, data;
 	height++;
@@ -194,11 +299,7 @@ void ks0108FillRect(uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t
 	while(h+8 <= height) {
 		h += 8;
 		y += 8;
-		ks0108GotoXY(x, y);
-		
-		for(i=0; i<=width; i++) {
-			ks0108WriteData(color);
-		}
+		ks0108FillPage(x, y/8, color, width+1);
 	}
 	
 	if(h < height) {
@@ -287,6 +388,49 @@ void ks0108SetDot(uint8_t x, uint8_t y, uint8_t color) {
 	
 	ks0108WriteData(data);					// write data back to display
 }
+#endif
+
+// write the collected dots
+static void ks0108AccFlush(void) {
+	uint8_t data;
+	
+	if(ks0108AccPage == 0xFF)
+		return;
+	
+#if KS0108_FRAMEBUFFER
+	data = ks0108Buffer[ks0108AccPage][ks0108AccX];
+#else
+	ks0108GotoXY(ks0108AccX, ks0108AccPage*8);
+	data = ks0108ReadData();
+#endif
+	if(ks0108AccColor == BLACK)
+		data |= ks0108AccBits;
+	else
+		data &= ~ks0108AccBits;
+#if KS0108_FRAMEBUFFER
+	ks0108Buffer[ks0108AccPage][ks0108AccX] = data;
+	ks0108MarkDirty(ks0108AccPage, ks0108AccX, ks0108AccX);
+#else
+	ks0108WriteData(data);
+#endif
+	
+	ks0108AccPage = 0xFF;
+}
+
+// collect a dot, the collected ones are written when a dot of another byte comes
+static void ks0108AccDot(uint8_t x, uint8_t y, uint8_t color) {
+	if(x >= LCD_W || y >= LCD_H)
+		return;
+	
+	if(x != ks0108AccX || y/8 != ks0108AccPage || color != ks0108AccColor) {
+		ks0108AccFlush();
+		ks0108AccX = x;
+		ks0108AccPage = y/8;
+		ks0108AccBits = 0;
+		ks0108AccColor = color;
+	}
+	ks0108AccBits |= 0x01 << (y%8);
+}
 
 //
 // Font Functions
@@ -297,59 +441,102 @@ uint8_t ks0108ReadFontData(const uint8_t* ptr) {
 }
 
 void ks0108SelectFont(const uint8_t* font, ks0108FontCallback callback, uint8_t color) {
+	uint16_t columns = 0;
+	
 	ks0108Font = font;
 	ks0108FontRead = callback;
 	ks0108FontColor = color;
+	
+	ks0108FontHeight = ks0108FontRead(ks0108Font+FONT_HEIGHT);
+	ks0108FontBands = (ks0108FontHeight+7)/8;
+	ks0108FontFirst = ks0108FontRead(ks0108Font+FONT_FIRST_CHAR);
+	ks0108FontCount = ks0108FontRead(ks0108Font+FONT_CHAR_COUNT);
+	
+	// sum up the width table once, instead of for every character
+	for(uint8_t i=0; i<KS0108_FONT_INDEX && i<ks0108FontCount; i++) {
+		ks0108FontIndex[i] = columns;
+		columns += ks0108FontRead(ks0108Font+FONT_WIDTH_TABLE+i);
+	}
 }
 
-int ks0108PutChar(char c) {
-	uint8_t width = 0;
-	uint8_t height = ks0108FontRead(ks0108Font+FONT_HEIGHT);
-	uint8_t bytes = (height+7)/8;
+// offset of the data of a glyph, c is counted from the font's first character
+static uint16_t ks0108GlyphOffset(uint8_t c) {
+	uint16_t columns;
+	uint8_t i;
 	
-	uint8_t firstChar = ks0108FontRead(ks0108Font+FONT_FIRST_CHAR);
-	uint8_t charCount = ks0108FontRead(ks0108Font+FONT_CHAR_COUNT);
+	if(c < KS0108_FONT_INDEX) {
+		columns = ks0108FontIndex[c];
+	} else {										// go on from the last indexed glyph
+		i = KS0108_FONT_INDEX-1;
+		columns = ks0108FontIndex[i];
+		for(; i<c; i++)
+			columns += ks0108FontRead(ks0108Font+FONT_WIDTH_TABLE+i);
+	}
 	
-	uint16_t index = 0;
-	uint8_t x = ks0108Coord.x, y = ks0108Coord.y;
+	return columns*ks0108FontBands+ks0108FontCount+FONT_WIDTH_TABLE;
+}
+
+// put one band of a glyph and the 1px gap behind it into buf, room columns
+// at most. returns the width including the gap, 0 if the font lacks c
+static uint8_t ks0108GlyphBand(char c, uint8_t band, uint8_t *buf, uint8_t room) {
+	const uint8_t *glyph;
+	uint8_t width, data;
 	
-	if(c < firstChar || c >= (firstChar+charCount)) {
-		return 1;
-	}
-	c-= firstChar;
+	if(c < ks0108FontFirst || c >= (ks0108FontFirst+ks0108FontCount))
+		return 0;
+	c -= ks0108FontFirst;
 	
-	// read width data, to get the index
-	for(uint8_t i=0; i<c; i++) {
-		index += ks0108FontRead(ks0108Font+FONT_WIDTH_TABLE+i);
-	}
-	index = index*bytes+charCount+FONT_WIDTH_TABLE;
 	width = ks0108FontRead(ks0108Font+FONT_WIDTH_TABLE+c);
+	glyph = ks0108Font+ks0108GlyphOffset(c)+band*width;
 	
-	// last but not least, draw the character
-	for(uint8_t i=0; i<bytes; i++) {
-		uint8_t page = i*width;
-		for(uint8_t j=0; j<width; j++) {
-			uint8_t data = ks0108FontRead(ks0108Font+index+page+j);
-			
-			if(height < (i+1)*8) {
-				data >>= (i+1)*8-height;
-			}
-			
-			if(ks0108FontColor == BLACK) {
-				ks0108WriteData(data);
-			} else {
-				ks0108WriteData(~data);
-			}
-		}
-		// 1px gap between chars
-		if(ks0108FontColor == BLACK) {
-			ks0108WriteData(0x00);
-		} else {
-			ks0108WriteData(0xFF);
+	for(uint8_t j=0; j<=width && j<room; j++) {
+		data = 0x00;								// 1px gap between chars
+		if(j < width)
+			data = ks0108FontRead(glyph+j);
+		if(ks0108FontHeight < (band+1)*8)
+			data >>= (band+1)*8-ks0108FontHeight;
+		
+		if(ks0108FontColor == BLACK)
+			buf[j] = data;
+		else
+			buf[j] = ~data;
+	}
+	
+	return width+1;
+}
+
+// draw the characters of str up to the end of the line, as one run per band
+// of the font. returns the number of characters drawn
+static uint8_t ks0108PutLine(const char *str, uint8_t src) {
+	uint8_t line[LCD_W];
+	uint8_t x = ks0108Coord.x, y = ks0108Coord.y, room = LCD_W-x, band, cols = 0, i = 0;
+	uint16_t width = 0;
+	char c;
+	
+	for(band=0; band<ks0108FontBands; band++) {
+		width = 0;
+		cols = 0;
+		for(i=0; ; i++) {
+			c = src == KS0108_SRC_PGM ? pgm_read_byte(str+i) : str[i];
+			if(c == 0 || c == '\n')
+				break;
+			width += ks0108GlyphBand(c, band, line+cols, room-cols);
+			cols = width < room ? width : room;
 		}
-		ks0108GotoXY(x, ks0108Coord.y+8);
+		ks0108Blit(x, y+band*8, cols, 8, line, NULL, KS0108_SRC_RAM);
 	}
-	ks0108GotoXY(x+width+1, y);
+	ks0108GotoXY(x+width, y);
+	
+	return i;
+}
+
+int ks0108PutChar(char c) {
+	char str[2] = {c, 0};
+	
+	if(c < ks0108FontFirst || c >= (ks0108FontFirst+ks0108FontCount)) {
+		return 1;
+	}
+	ks0108PutLine(str, KS0108_SRC_RAM);
 	
 	return 0;
 }
@@ -358,11 +545,11 @@ void ks0108Puts(char* str) {
 	int x = ks0108Coord.x;
 	while(*str != 0) {
 		if(*str == '\n') {
-			ks0108GotoXY(x, ks0108Coord.y+ks0108FontRead(ks0108Font+FONT_HEIGHT));
+			ks0108GotoXY(x, ks0108Coord.y+ks0108FontHeight);
+			str++;
 		} else {
-			ks0108PutChar(*str);
+			str += ks0108PutLine(str, KS0108_SRC_RAM);
 		}
-		str++;
 	}
 }
 
@@ -370,22 +557,20 @@ void ks0108Puts_P(PGM_P str) {
 	int x = ks0108Coord.x;
 	while(pgm_read_byte(str) != 0) {
 		if(pgm_read_byte(str) == '\n') {
-			ks0108GotoXY(x, ks0108Coord.y+ks0108FontRead(ks0108Font+FONT_HEIGHT));
+			ks0108GotoXY(x, ks0108Coord.y+ks0108FontHeight);
+			str++;
 		} else {
-			ks0108PutChar(pgm_read_byte(str));
+			str += ks0108PutLine(str, KS0108_SRC_PGM);
 		}
-		str++;
 	}
 }
 
 uint8_t ks0108CharWidth(char c) {
 	uint8_t width = 0;
-	uint8_t firstChar = ks0108FontRead(ks0108Font+FONT_FIRST_CHAR);
-	uint8_t charCount = ks0108FontRead(ks0108Font+FONT_CHAR_COUNT);
 	
 	// read width data
-	if(c >= firstChar && c < (firstChar+charCount)) {
-		c -= firstChar;
+	if(c >= ks0108FontFirst && c < (ks0108FontFirst+ks0108FontCount)) {
+		c -= ks0108FontFirst;
 		width = ks0108FontRead(ks0108Font+FONT_WIDTH_TABLE+c)+1;
 	}
 	
@@ -412,6 +597,16 @@ uint16_t ks0108StringWidth_P(PGM_P str) {
 	return width;
 }
 
+#if KS0108_FRAMEBUFFER
+void ks0108GotoXY(uint8_t x, uint8_t y) {
+	if(x > 127) x = 0;								// ensure that coordinates are legal
+	if(y > 63)  y = 0;
+	
+	ks0108Coord.x = x;								// only the buffer is addressed,
+	ks0108Coord.y = y;								// ks0108Flush() sets the display's address
+	ks0108Coord.page = y/8;
+}
+#else
 void ks0108GotoXY(uint8_t x, uint8_t y) {
 	uint8_t chip = CHIP1, cmd;
 	
@@ -433,6 +628,7 @@ void ks0108GotoXY(uint8_t x, uint8_t y) {
 	ks0108WriteCommand(cmd, CHIP1);
 	ks0108WriteCommand(cmd, CHIP2);
 }
+#endif
 
 void ks0108Init(uint8_t invert) {
 	ks0108Coord.x = 0;
@@ -453,52 +649,90 @@ void ks0108Init(uint8_t invert) {
 	_delay_us(50);
 	ks0108ClearScreen();							// display clear
 	ks0108GotoXY(0,0);
+#if KS0108_FRAMEBUFFER
+	ks0108Flush();
+#endif
+#if KS0108_ASYNC_FLUSH
+	TCCR3A = 0x00;									// timer 3 in ctc mode, prescaler 8
+	TCCR3B = (0x01 << WGM32) | (0x01 << CS31);
+	OCR3A = (uint16_t)(KS0108_FLUSH_TICK_US * (F_CPU / 8 / 1000000UL)) - 1;
+#endif
 }
 
+#if KS0108_BUSY_POLL
+// poll the busy flag of the selected chip until it is ready, the command and
+// data port are left as they were
+void ks0108WaitReady(void) {
+	uint8_t cmdPort = LCD_CMD_PORT, dataDir = LCD_DATA_DIR, dataOut = LCD_DATA_OUT, tries = KS0108_BUSY_TRIES, status;
+	
+	LCD_DATA_DIR = 0x00;							// data port is input
+	LCD_DATA_OUT = 0x00;
+	LCD_CMD_PORT = (cmdPort & ~(0x01 << D_I)) | (0x01 << R_W);	// D/I = 0, R/W = 1
+	__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_EN_LOW, 4));
+	
+	do {
+		LCD_CMD_PORT |= 0x01 << EN;
+		__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_DATA, 1));
+		status = LCD_DATA_IN;						// read status
+		__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_EN_HIGH - KS0108_T_DATA, 3));
+		LCD_CMD_PORT &= ~(0x01 << EN);
+		__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_EN_LOW, 6));
+	} while((status & LCD_BUSY) && --tries);
+	
+	LCD_CMD_PORT = cmdPort;
+	LCD_DATA_OUT = dataOut;
+	LCD_DATA_DIR = dataDir;
+}
+#else
+inline void ks0108WaitReady(void) {
+	__builtin_avr_delay_cycles(KS0108_NS_TO_CYCLES(KS0108_T_BUSY));
+}
+#endif
+
 inline void ks0108Enable(void) {
-	LCD_CMD_PORT |= 0x01 << EN;						// EN high level width: min. 450ns
-	asm volatile("nop\n\t"
-				 "nop\n\t"
-				 "nop\n\t"
-				 "nop\n\t"
-				 "nop\n\t"
-				 "nop\n\t"
-				 ::);
+	LCD_CMD_PORT |= 0x01 << EN;						// EN high level width
+	__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_EN_HIGH, 2));
 	LCD_CMD_PORT &= ~(0x01 << EN);
-	for(volatile uint8_t i=0; i<16; i++);			// a little delay loop (faster than reading the busy flag)
+	ks0108WaitReady();
+}
+
+#if KS0108_FRAMEBUFFER
+inline uint8_t ks0108ReadData(void) {
+	if(ks0108Coord.x >= 128)
+		return 0;
+	return ks0108Buffer[ks0108Coord.page][ks0108Coord.x];
+}
+#else
+// one read strobe, the chip, D/I = 1 and R/W = 1 are already selected
+static inline uint8_t ks0108ReadStrobe(void) {
+	uint8_t data;
+	
+	LCD_CMD_PORT |= 0x01 << EN;						// EN high level width
+	__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_DATA, 1));
+	
+	data = LCD_DATA_IN;								// read Data			 
+	
+	__builtin_avr_delay_cycles(KS0108_WAIT_CYCLES(KS0108_T_EN_HIGH - KS0108_T_DATA, 3));
+	LCD_CMD_PORT &= ~(0x01 << EN);
+	ks0108WaitReady();
+	return data;
 }
 
 uint8_t ks0108DoReadData(uint8_t first) {
 	uint8_t data;
-	volatile uint8_t i;
+	
+	uint8_t chip = ks0108Coord.x < 64 ? CHIP1 : CHIP2;
 	
 	LCD_DATA_OUT = 0x00;
 	LCD_DATA_DIR = 0x00;							// data port is input
 	
-	if(ks0108Coord.x < 64) {
-		LCD_CMD_PORT &= ~(0x01 << CSEL2);			// deselect chip 2
-		LCD_CMD_PORT |= 0x01 << CSEL1;				// select chip 1
-	} else if(ks0108Coord.x >= 64) {
-		LCD_CMD_PORT &= ~(0x01 << CSEL1);			// deselect chip 1
-		LCD_CMD_PORT |= 0x01 << CSEL2;				// select chip 2
-	}
 	if(ks0108Coord.x == 64 && first) {				// chip2 X-address = 0
 		ks0108WriteCommand(LCD_SET_ADD, CHIP2); 	// wuff wuff
 	}
 	
-	LCD_CMD_PORT |= 0x01 << D_I;					// D/I = 1
-	LCD_CMD_PORT |= 0x01 << R_W;					// R/W = 1
-	
-	LCD_CMD_PORT |= 0x01 << EN;						// EN high level width: min. 450ns
-	asm volatile("nop\n\t"
-				 "nop\n\t"
-				 "nop\n\t"
-				 ::);
-	
-	data = LCD_DATA_IN;								// read Data			 
-	
-	LCD_CMD_PORT &= ~(0x01 << EN);
-	for(i=0; i<8; i++);								// a little delay loop (faster than reading the busy flag)
+	ks0108SetCtrl(ks0108ChipBits(chip) | (0x01 << D_I) | (0x01 << R_W));	// D/I = 1, R/W = 1
+	data = ks0108ReadStrobe();
+	ks0108AddrInc(chip);							// reads increment the column too
 	
 	LCD_DATA_DIR = 0xFF;
 	
@@ -513,26 +747,366 @@ inline uint8_t ks0108ReadData(void) {
 	ks0108DoReadData(1);							// dummy read
 	return ks0108DoReadData(0);						// "real" read
 }
+#endif
 
 void ks0108WriteCommand(uint8_t cmd, uint8_t chip) {
-	if(chip == CHIP1) {
-		LCD_CMD_PORT &= ~(0x01 << CSEL2);			// deselect chip 2
-		LCD_CMD_PORT |= 0x01 << CSEL1;				// select chip 1
-	} else if(chip == CHIP2) {
-		LCD_CMD_PORT &= ~(0x01 << CSEL1);			// deselect chip 1
-		LCD_CMD_PORT |= 0x01 << CSEL2;				// select chip 2
+	if((cmd & 0xC0) == LCD_SET_ADD) {				// column register
+		if(ks0108ShadowAddr[chip] == (cmd & 0x3F)) {
+			ks0108Elided++;
+			return;
+		}
+		ks0108ShadowAddr[chip] = cmd & 0x3F;
+	} else if((cmd & 0xF8) == LCD_SET_PAGE) {		// page register
+		if(ks0108ShadowPage[chip] == (cmd & 0x07)) {
+			ks0108Elided++;
+			return;
+		}
+		ks0108ShadowPage[chip] = cmd & 0x07;
 	}
 	
-	LCD_CMD_PORT &= ~(0x01 << D_I);					// D/I = 0
-	LCD_CMD_PORT &= ~(0x01 << R_W);					// R/W = 0
+	ks0108SetCtrl(ks0108ChipBits(chip));			// D/I = 0, R/W = 0
 	LCD_DATA_DIR = 0xFF;							// data port is output
 	LCD_DATA_OUT = cmd;								// write command
 	ks0108Enable();									// enable
 	LCD_DATA_OUT = 0x00;
 }
 
+// write count bytes to a page of the display, starting at column x. The address
+// is set and the port is set up once per chip, the chip increments its column
+// address by itself
+static void ks0108BusRun(uint8_t x, uint8_t page, const uint8_t *data, uint8_t count, uint8_t src) {
+	uint8_t chip, n, i, byte;
+	
+	while(count > 0) {
+		chip = x < 64 ? CHIP1 : CHIP2;
+		n = (x | 63) + 1 - x;						// columns left on this chip
+		if(n > count)
+			n = count;
+		
+		ks0108WriteCommand(LCD_SET_PAGE | page, chip);
+		ks0108WriteCommand(LCD_SET_ADD | (x & 63), chip);
+		
+		ks0108SetCtrl(ks0108ChipBits(chip) | (0x01 << D_I));	// D/I = 1, R/W = 0
+		LCD_DATA_DIR = 0xFF;						// data port is output
+		
+		for(i=0; i<n; i++) {
+			if(src == KS0108_SRC_PGM)
+				byte = pgm_read_byte(data++);
+			else if(src == KS0108_SRC_RAM)
+				byte = *data++;
+			else
+				byte = *data;
+			
+			if(ks0108Inverted)
+				byte = ~byte;
+			LCD_DATA_OUT = byte;
+			ks0108Enable();
+		}
+		ks0108ShadowAddr[chip] = (x+n) & 63;		// where the chip's column ended up
+		
+		x += n;
+		count -= n;
+	}
+	LCD_DATA_OUT = 0x00;
+}
+
+#if !KS0108_FRAMEBUFFER
+// read count bytes of a page of the display, starting at column x. The address
+// is set once per chip, one dummy read fills the chip's output latch and every
+// further read returns the next column
+static void ks0108ReadRun(uint8_t x, uint8_t page, uint8_t *data, uint8_t count) {
+	uint8_t chip, n, i, byte;
+	
+	while(count > 0) {
+		chip = x < 64 ? CHIP1 : CHIP2;
+		n = (x | 63) + 1 - x;						// columns left on this chip
+		if(n > count)
+			n = count;
+		
+		ks0108WriteCommand(LCD_SET_PAGE | page, chip);
+		ks0108WriteCommand(LCD_SET_ADD | (x & 63), chip);
+		
+		ks0108SetCtrl(ks0108ChipBits(chip) | (0x01 << D_I) | (0x01 << R_W));	// D/I = 1, R/W = 1
+		LCD_DATA_OUT = 0x00;
+		LCD_DATA_DIR = 0x00;						// data port is input
+		
+		ks0108ReadStrobe();							// dummy read
+		for(i=0; i<n; i++) {
+			byte = ks0108ReadStrobe();
+			*data++ = ks0108Inverted ? ~byte : byte;
+		}
+		ks0108ShadowAddr[chip] = (x+n+1) & 63;		// the dummy read counts too
+		
+		x += n;
+		count -= n;
+	}
+	LCD_DATA_DIR = 0xFF;
+}
+#endif
+
+// write count bytes to a page, starting at column x, in one run.
+// Afterwards the current position is the column behind the run
+static void ks0108PageRun(uint8_t x, uint8_t page, const uint8_t *data, uint8_t count, uint8_t src) {
+	if(x >= LCD_W || page >= LCD_PAGES)
+		return;
+	if(count > LCD_W-x)								// clip to the display
+		count = LCD_W-x;
+	
+#if KS0108_FRAMEBUFFER
+	uint8_t *buf = &ks0108Buffer[page][x];
+	
+	for(uint8_t i=0; i<count; i++) {
+		if(src == KS0108_SRC_PGM)
+			*buf++ = pgm_read_byte(data++);
+		else if(src == KS0108_SRC_RAM)
+			*buf++ = *data++;
+		else
+			*buf++ = *data;
+	}
+	if(count > 0)
+		ks0108MarkDirty(page, x, x+count-1);
+#else
+	ks0108BusRun(x, page, data, count, src);
+#endif
+	
+	ks0108Coord.x = x+count;
+	ks0108Coord.y = page*8;
+	ks0108Coord.page = page;
+}
+
+void ks0108WritePage(uint8_t x, uint8_t page, const uint8_t *data, uint8_t count) {
+	ks0108PageRun(x, page, data, count, KS0108_SRC_RAM);
+}
+
+void ks0108WritePage_P(uint8_t x, uint8_t page, const uint8_t *data, uint8_t count) {
+	ks0108PageRun(x, page, data, count, KS0108_SRC_PGM);
+}
+
+void ks0108FillPage(uint8_t x, uint8_t page, uint8_t data, uint8_t count) {
+	ks0108PageRun(x, page, &data, count, KS0108_SRC_FILL);
+}
+
+// byte of a sprite band which is shifted into a page, 0 if there is no such band
+static inline uint8_t ks0108SpriteByte(const uint8_t *data, uint8_t band, uint8_t bands, uint8_t width, uint8_t i, uint8_t src) {
+	if(band >= bands)
+		return 0;
+	if(src == KS0108_SRC_PGM)
+		return pgm_read_byte(data + band*width + i);
+	return data[band*width + i];
+}
+
+// rows of a sprite band which are drawn, lastRows are those inside the sprite's
+// height for the last band
+static inline uint8_t ks0108SpriteMask(const uint8_t *mask, uint8_t band, uint8_t bands, uint8_t width, uint8_t i, uint8_t lastRows, uint8_t src) {
+	uint8_t m;
+	
+	if(band >= bands)
+		return 0x00;
+	m = band == bands-1 ? lastRows : 0xFF;
+	if(mask)
+		m &= ks0108SpriteByte(mask, band, bands, width, i, src);
+	return m;
+}
+
+// draw a sprite and its mask from RAM or PROGMEM, one run per page
+static void ks0108Blit(uint8_t x, uint8_t y, uint8_t width, uint8_t height, const uint8_t *sprite, const uint8_t *mask, uint8_t src) {
+	uint8_t bands = (height+7)/8, shift = y%8, cols = width, page, lastPage, band, i;
+	uint8_t lastRows, s, m, *dst;
+#if !KS0108_FRAMEBUFFER
+	uint8_t run[LCD_W];
+#endif
+	
+	if(x >= LCD_W || y >= LCD_H || width == 0 || height == 0)
+		return;
+	if(cols > LCD_W-x)								// clip to the display
+		cols = LCD_W-x;
+	lastPage = (y+height-1)/8;
+	if(lastPage >= LCD_PAGES)
+		lastPage = LCD_PAGES-1;
+	lastRows = 0xFF >> (bands*8-height);			// rows of the last band inside the sprite
+	
+	for(page = y/8, band = 0; page <= lastPage; page++, band++) {
+#if KS0108_FRAMEBUFFER
+		dst = &ks0108Buffer[page][x];
+#else
+		dst = run;
+		if(mask || shift || (band == bands-1 && lastRows != 0xFF))
+			ks0108ReadRun(x, page, run, cols);		// not every bit is replaced
+#endif
+		for(i=0; i<cols; i++) {
+			// band covers the page from row shift on, the band above it the rows before
+			s = ks0108SpriteByte(sprite, band, bands, width, i, src) << shift;
+			m = ks0108SpriteMask(mask, band, bands, width, i, lastRows, src) << shift;
+			if(shift && band > 0) {
+				s |= ks0108SpriteByte(sprite, band-1, bands, width, i, src) >> (8-shift);
+				m |= ks0108SpriteMask(mask, band-1, bands, width, i, lastRows, src) >> (8-shift);
+			}
+			
+			dst[i] = (dst[i] & ~m) | (s & m);
+		}
+#if KS0108_FRAMEBUFFER
+		ks0108MarkDirty(page, x, x+cols-1);
+#else
+		ks0108BusRun(x, page, run, cols, KS0108_SRC_RAM);
+#endif
+	}
+}
+
+void ks0108DrawSprite_P(uint8_t x, uint8_t y, uint8_t width, uint8_t height, const uint8_t *sprite, const uint8_t *mask) {
+	ks0108Blit(x, y, width, height, sprite, mask, KS0108_SRC_PGM);
+}
+
+#if KS0108_FRAMEBUFFER
+void ks0108WriteData(uint8_t data) {
+	uint8_t x = ks0108Coord.x, page = ks0108Coord.page, yOffset;
+	
+	if(x >= 128)
+		return;
+	
+	yOffset = ks0108Coord.y%8;
+	if(yOffset != 0) {
+		ks0108Buffer[page][x] |= data << yOffset;	// first page
+		ks0108MarkDirty(page, x, x);
+		
+		if(page < LCD_PAGES-1) {					// second page
+			ks0108Buffer[page+1][x] |= data >> (8-yOffset);
+			ks0108MarkDirty(page+1, x, x);
+		}
+	} else {
+		ks0108Buffer[page][x] = data;
+		ks0108MarkDirty(page, x, x);
+	}
+	ks0108Coord.x++;
+}
+
+void ks0108Flush(void) {
+	uint8_t page, x1, x2;
+	
+#if KS0108_ASYNC_FLUSH
+	while(!ks0108FlushDone);						// the bus is busy
+#endif
+	
+	for(page=0; page<LCD_PAGES; page++) {
+		x1 = ks0108DirtyMin[page];
+		x2 = ks0108DirtyMax[page];
+		if(x1 > x2)
+			continue;
+		
+		ks0108DirtyMin[page] = 0xFF;				// clean
+		ks0108DirtyMax[page] = 0;
+		
+		ks0108BusRun(x1, page, &ks0108Buffer[page][x1], x2-x1+1, KS0108_SRC_RAM);
+	}
+}
+
+#if KS0108_ASYNC_FLUSH
+// start writing the changed columns in the background, KS0108_FLUSH_BUDGET
+// bytes at most, the rest is left for the next call. When the budget runs
+// out, the next call starts at the first page this one did not serve
+// completely, so every dirty page gets its turn however often the pages in
+// front of it are redrawn.
+// Only the bounds of the changed columns are taken, the interrupt reads the
+// bytes from ks0108Buffer when it gets to them. Drawing before the flush is
+// done can show part of the next frame on the display; those bytes are marked
+// changed again, so the next flush brings the display up to date.
+// returns 0 if the last flush is still running, ks0108FlushDone is set again
+// when this one is complete
+uint8_t ks0108FlushAsync(void) {
+	uint16_t budget = KS0108_FLUSH_BUDGET;
+	uint8_t i, page, x1, x2;
+	
+	if(!ks0108FlushDone)
+		return 0;
+	
+	page = ks0108FlushFirst;
+	for(i=0; i<LCD_PAGES; i++) {
+		x1 = ks0108DirtyMin[page];
+		x2 = ks0108DirtyMax[page];
+		
+		if(x1 > x2 || budget == 0) {
+			ks0108FlushMin[page] = 0xFF;			// nothing to write
+			ks0108FlushMax[page] = 0;
+		} else {
+			if(x2-x1 >= budget) {					// take what fits, leave the rest dirty
+				x2 = x1+budget-1;
+				ks0108DirtyMin[page] = x2+1;
+				ks0108FlushFirst = page;
+			} else {
+				ks0108DirtyMin[page] = 0xFF;		// clean
+				ks0108DirtyMax[page] = 0;
+				if(x2-x1+1 == budget)				// used up exactly, the next page goes first
+					ks0108FlushFirst = (page+1) % LCD_PAGES;
+			}
+			budget -= x2-x1+1;
+			
+			ks0108FlushMin[page] = x1;
+			ks0108FlushMax[page] = x2;
+		}
+		
+		page = (page+1) % LCD_PAGES;
+	}
+	
+	if(budget == KS0108_FLUSH_BUDGET)				// nothing changed
+		return 1;
+	if(budget > 0)									// everything fit
+		ks0108FlushFirst = 0;
+	
+	ks0108FlushPage = 0;
+	ks0108FlushX = ks0108FlushMin[0];
+	ks0108FlushAddr = 1;
+	ks0108FlushDone = 0;
+	
+	TCNT3 = 0;										// go
+	TIFR3 = 0x01 << OCF3A;
+	TIMSK3 |= 0x01 << OCIE3A;
+	
+	return 1;
+}
+
+// write the next KS0108_FLUSH_BYTES bytes of the running flush
+ISR(TIMER3_COMPA_vect, ISR_NOBLOCK) {
+	uint8_t n = KS0108_FLUSH_BYTES, page = ks0108FlushPage, x = ks0108FlushX, chip, data;
+	
+	TIMSK3 &= ~(0x01 << OCIE3A);					// no nesting of this interrupt
+	
+	while(n > 0 && page < LCD_PAGES) {
+		if(x > ks0108FlushMax[page]) {				// next page
+			if(++page < LCD_PAGES)
+				x = ks0108FlushMin[page];
+			ks0108FlushAddr = 1;
+			continue;
+		}
+		
+		chip = x < 64 ? CHIP1 : CHIP2;
+		if(ks0108FlushAddr || x == 64) {			// new run or chip boundary
+			ks0108WriteCommand(LCD_SET_PAGE | page, chip);
+			ks0108WriteCommand(LCD_SET_ADD | (x & 63), chip);
+			ks0108SetCtrl(ks0108ChipBits(chip) | (0x01 << D_I));	// D/I = 1, R/W = 0
+			ks0108FlushAddr = 0;
+		}
+		
+		data = ks0108Buffer[page][x++];
+		if(ks0108Inverted)
+			data = ~data;
+		LCD_DATA_OUT = data;						// write data
+		ks0108Enable();
+		ks0108AddrInc(chip);
+		n--;
+	}
+	LCD_DATA_OUT = 0x00;
+	
+	ks0108FlushPage = page;
+	ks0108FlushX = x;
+	
+	if(page < LCD_PAGES)
+		TIMSK3 |= 0x01 << OCIE3A;					// more to come
+	else
+		ks0108FlushDone = 1;
+}
+#endif
+#else
 void ks0108WriteData(uint8_t data) {
-	uint8_t displayData, yOffset, cmdPort;
+	uint8_t displayData, yOffset, cmdPort, chip;
 
 #ifdef DEBUG
 	volatile uint16_t i;
@@ -542,18 +1116,11 @@ void ks0108WriteData(uint8_t data) {
 	if(ks0108Coord.x >= 128)
 		return;
 
-	if(ks0108Coord.x < 64) {
-		LCD_CMD_PORT &= ~(0x01 << CSEL2);			// deselect chip 2
-		LCD_CMD_PORT |= 0x01 << CSEL1;				// select chip 1
-	} else if(ks0108Coord.x >= 64) {
-		LCD_CMD_PORT &= ~(0x01 << CSEL1);			// deselect chip 1
-		LCD_CMD_PORT |= 0x01 << CSEL2;				// select chip 2
-	}
+	chip = ks0108Coord.x < 64 ? CHIP1 : CHIP2;
 	if(ks0108Coord.x == 64)							// chip2 X-address = 0
 		ks0108WriteCommand(LCD_SET_ADD, CHIP2);
 	
-	LCD_CMD_PORT |= 0x01 << D_I;					// D/I = 1
-	LCD_CMD_PORT &= ~(0x01 << R_W);					// R/W = 0
+	ks0108SetCtrl(ks0108ChipBits(chip) | (0x01 << D_I));	// D/I = 1, R/W = 0
 	LCD_DATA_DIR = 0xFF;							// data port is output
 	
 	
@@ -571,6 +1138,7 @@ void ks0108WriteData(uint8_t data) {
 			displayData = ~displayData;
 		LCD_DATA_OUT = displayData;					// write data
 		ks0108Enable();								// enable
+		ks0108AddrInc(chip);
 		
 		// second page
 		ks0108GotoXY(ks0108Coord.x, ks0108Coord.y+8);
@@ -585,6 +1153,7 @@ void ks0108WriteData(uint8_t data) {
 			displayData = ~displayData;
 		LCD_DATA_OUT = displayData;					// write data
 		ks0108Enable();								// enable
+		ks0108AddrInc(chip);
 		
 		ks0108GotoXY(ks0108Coord.x+1, ks0108Coord.y-8);
 	} else {
@@ -592,7 +1161,9 @@ void ks0108WriteData(uint8_t data) {
 			data = ~data;
 		LCD_DATA_OUT = data;						// write data
 		ks0108Enable();								// enable
+		ks0108AddrInc(chip);
 		ks0108Coord.x++;
 	}
 	LCD_DATA_OUT = 0x00;
 }
+#endif
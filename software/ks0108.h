@@ -43,6 +43,9 @@
 #define LCD_SET_PAGE		0xB8
 #define LCD_DISP_START		0xC0
 
+// Status Bits
+#define LCD_BUSY			0x80
+
 // Colors
 #define BLACK				0xFF
 #define WHITE				0x00
@@ -58,6 +61,45 @@
 // Uncomment for slow drawing
 // #define DEBUG
 
+// Draw into a copy of the display in RAM (1 KB) instead of the display itself.
+// Nothing is read back from the display, ks0108Flush() writes the changed
+// columns of each page in one run per chip
+#define KS0108_FRAMEBUFFER	1
+
+// Write the framebuffer in the background from the compare-interrupt of
+// timer 3, a few bytes per interrupt (see ks0108FlushAsync()). The interrupt
+// runs with interrupts enabled, so it never delays the joystick's interrupts
+#define KS0108_ASYNC_FLUSH	1
+#define KS0108_FLUSH_TICK_US	100		// time between two interrupts
+#define KS0108_FLUSH_BYTES	2			// bytes written per interrupt
+#define KS0108_FLUSH_BUDGET	256			// bytes written per frame at most
+
+// Bus timing from the datasheet in ns, the delays are computed from F_CPU at
+// compile time. KS0108_T_BUSY is only waited without KS0108_BUSY_POLL and
+// depends on the panel, raise it if bytes get lost
+#define KS0108_T_EN_HIGH	450			// E high level width
+#define KS0108_T_EN_LOW		450			// E low level width
+#define KS0108_T_DATA		320			// data valid after the rising E on a read
+#define KS0108_T_BUSY		4000		// the controller is busy after a transfer
+
+// Read the busy flag after each transfer and start the next one as soon as the
+// controller is ready, instead of waiting KS0108_T_BUSY
+#define KS0108_BUSY_POLL	1
+#define KS0108_BUSY_TRIES	255			// polls until a missing display is given up on
+
+// Glyphs of the selected font whose position is kept in RAM (2 bytes each),
+// the position of later ones is summed up from the last of them
+#define KS0108_FONT_INDEX	96
+
+#if KS0108_ASYNC_FLUSH && !KS0108_FRAMEBUFFER
+#error "KS0108_ASYNC_FLUSH needs KS0108_FRAMEBUFFER"
+#endif
+
+#define LCD_PAGES			(LCD_H/8)
+
+// bits of the command port selecting chip, register and direction
+#define LCD_CTRL_MASK		((0x01 << CSEL1) | (0x01 << CSEL2) | (0x01 << D_I) | (0x01 << R_W))
+
 typedef struct {
 	uint8_t x;
 	uint8_t y;
@@ -101,4 +143,21 @@ inline uint8_t ks0108ReadData(void);
 void ks0108WriteCommand(uint8_t cmd, uint8_t chip);
 void ks0108WriteData(uint8_t data);
 
+// Column Runs, count bytes to a page starting at column x
+void ks0108WritePage(uint8_t x, uint8_t page, const uint8_t *data, uint8_t count);
+void ks0108WritePage_P(uint8_t x, uint8_t page, const uint8_t *data, uint8_t count);
+void ks0108FillPage(uint8_t x, uint8_t page, uint8_t data, uint8_t count);
+
+// Sprites in PROGMEM, stored like the display: (height+7)/8 bands of width
+// bytes, bit 0 is the top row of a band. A set bit of the optional mask (same
+// layout, NULL for none) marks a pixel which is drawn, the others are left as
+// they are. y does not have to be a multiple of 8
+void ks0108DrawSprite_P(uint8_t x, uint8_t y, uint8_t width, uint8_t height, const uint8_t *sprite, const uint8_t *mask);
+#if KS0108_FRAMEBUFFER
+void ks0108Flush(void);
+#endif
+#if KS0108_ASYNC_FLUSH
+uint8_t ks0108FlushAsync(void);
+#endif
+
 #endif
@@ -2,6 +2,77 @@
 #define SW_TIMING_ENABLE_CT 8000
 #define SW_TIMING_READING 1
 #define SW_TIMING_READING_CT 2000
+#define SW_TIMING_SETTLE 2
+#define SW_TIMING_BUSY 3
+
+// timer 1 runs with a prescaler of 8, so one tick is 0.5us
+#define SW_US_TO_TICKS(us) ((us) * 2)
+
+// The ways the trigger can be scheduled (see sw_set_schedule())
+//  SW_SCHED_LEGACY:       hold the trigger for SW_TIMING_READING_CT, then wait
+//                         SW_TIMING_ENABLE_CT (a fixed 200 Hz)
+//  SW_SCHED_FIXED:        one trigger every <period> ticks. With SW_READY_EDGE
+//                         the trigger is held for a varying time, so the
+//                         time to keep it released is computed from the
+//                         measured hold every time it is released
+//  SW_SCHED_BACK_TO_BACK: trigger again <guard> ticks after the last bit of a
+//                         packet landed. Packets come as fast as the device
+//                         can deliver them. If a packet does not complete,
+//                         the next trigger follows after SW_SCHED_TIMEOUT_CT
+#define SW_SCHED_LEGACY 0
+#define SW_SCHED_FIXED 1
+#define SW_SCHED_BACK_TO_BACK 2
+
+#define SW_SCHED_DEFAULT SW_SCHED_LEGACY
+#define SW_SCHED_TIMEOUT_CT SW_US_TO_TICKS(4000)
+
+// the shortest guard-time the timer can safely be re-armed with. It covers
+// the cycles from reading TCNT1 to writing the new OCR1A
+#define SW_SCHED_MIN_GUARD_CT SW_US_TO_TICKS(4)
+
+// the longest guard-time of SW_SCHED_BACK_TO_BACK. It is added to TCNT1,
+// which is at SW_SCHED_TIMEOUT_CT at most, and must not overflow
+#define SW_SCHED_MAX_GUARD_CT (0xFFFF - SW_SCHED_TIMEOUT_CT)
+
+// Release the trigger when the device signals it is ready instead of holding
+// it for a fixed SW_TIMING_READING_CT.
+// After the trigger is pulled, the device pulls its clock-line low for ~400us
+// (busy) and releases it again (ready). SW_READY_SETTLE_CT after pulling the
+// trigger the clock-line is checked to be low, then the rising edge is awaited
+// and the trigger is released a guard-time after it. If no edge comes, the
+// trigger is released after SW_TIMING_READING_CT as before.
+// The guard-time starts at SW_READY_GUARD_MAX_CT and is lowered by
+// SW_READY_GUARD_DOWN_CT with every packet that completes and raised by
+// SW_READY_GUARD_UP_CT for every one that does not.
+// Not available with SW_CAPTURE_MULTI and SW_CAPTURE_POLL
+#define SW_READY_EDGE (SW_CAPTURE_MODE != SW_CAPTURE_MULTI && SW_CAPTURE_MODE != SW_CAPTURE_POLL)
+#define SW_READY_SETTLE_CT SW_US_TO_TICKS(100)
+#define SW_READY_GUARD_MIN_CT SW_US_TO_TICKS(20)
+#define SW_READY_GUARD_MAX_CT SW_US_TO_TICKS(600)
+#define SW_READY_GUARD_DOWN_CT 2
+#define SW_READY_GUARD_UP_CT SW_US_TO_TICKS(50)
+
+// Capture variable-length bursts instead of fixed 48-bit packets.
+// Other SideWinder models send other packet-lengths and gamepads can be
+// daisy-chained to send the data of several devices in one burst. With
+// SW_BURST the end of a burst is detected by the clock-line staying quiet
+// for SW_BURST_GAP_CT ticks of timer 2 (2us each), which is re-started on
+// every edge. Bursts of up to SW_BURST_MAX_DEVICES * 64 bits are stored and
+// split into per-device records by sw_burst_decode(). A burst of exactly 48
+// bits is also passed on as a regular packet.
+// Works with SW_CAPTURE_C and SW_CAPTURE_ASM
+#define SW_BURST 0
+#define SW_BURST_MAX_DEVICES 3
+#define SW_BURST_GAP_CT 30
+
+// the burst-storage has one byte more than needed, running into it means
+// the burst was longer than SW_BURST_MAX_DEVICES * 64 bits
+#define SW_BURST_BYTES (SW_BURST_MAX_DEVICES * 8 + 1)
+
+// Reject packets with a wrong parity before they are published.
+// Valid packets contain an odd number of set bits, parity-bit included
+#define SW_PARITY_CHECK 1
+#define SW_PARITY_ODD 1
 
 // the RCVINDI-Pin goes low when the MCU starts capturing a new Packet.
 // It goes high when a complete Packet has been received
@@ -19,6 +90,7 @@
 #define SW_CLKINDI_DDR DDRH
 #define SW_CLKINDI_PORT PORTH
 #define SW_CLKINDI_P PH6
+#define SW_CLKINDI_PIN PINH
 
 // The Pin to which the Clock-Line (SUBD-Pin 2) from the Joystick is connected to
 // Attention: The Code blow assumes this to be the INT5-Line. You need to
@@ -30,7 +102,8 @@
 #define SW_CLK_P PE5
 
 // The Pin to which the Data-Line (SUBD-Pin 7) from the Joystick is connected to
-// Can be any GPIO-Pin
+// Can be any GPIO-Pin (when using SW_CAPTURE_ASM it needs to be one of PINA-PING,
+// as the Handler tests it with a sbic-instruction)
 #define SW_DTA_DDR DDRB
 #define SW_DTA_PIN PINB
 #define SW_DTA_P PB6
@@ -41,6 +114,121 @@
 #define SW_TIMING_PORT PORTB
 #define SW_TIMING_P PB5
 
+// The way the Clock-Interrupt captures the bits sent by the Joystick
+//  SW_CAPTURE_C:   a plain C Interrupt-Handler. Costs a gcc prologue/epilogue,
+//                  a /8 and a %8-switch on each edge
+//  SW_CAPTURE_ASM: a hand written naked Interrupt-Handler. It keeps a pointer to
+//                  the current byte in r2:r3, the mask of the current bit in r4
+//                  and the low byte of the end-pointer in r5, so each edge costs
+//                  a fixed number of cycles (see ISR(INT5_vect) below)
+//  SW_CAPTURE_SPI: the Clock-Line drives SCK of the SPI, which runs in slave
+//                  mode and shifts in the bits by hardware. Only one interrupt
+//                  per byte (6 per packet instead of 48) is taken.
+//                  The USART in synchronous slave mode can not be used for this,
+//                  as it expects start- and stop-bits around each frame.
+//  SW_CAPTURE_ANALYZER: protocol-analyzer. The Clock-Line drives the
+//                  input-capture of timer 5, which timestamps every edge with
+//                  a resolution of 62.5ns. Per-bit period, jitter and the gap
+//                  between packets are collected (see sw_an_get_stats()).
+//                  Meant for characterizing devices, not for flying
+//  SW_CAPTURE_MULTI: up to SW_PORTS gameports at once, each on its own
+//                  external interrupt INT4-INT7 (see SW_MULTI_* below).
+//                  Every port has its own C Interrupt-Handler with its state
+//                  at a constant address, so the cost of an edge does not
+//                  grow with the number of ports
+//  SW_CAPTURE_POLL: no interrupt per edge at all. Right after the trigger is
+//                  released, ISR(TIMER1_COMPA_vect) polls the clock- and
+//                  data-line in a cycle-counted loop with interrupts masked,
+//                  until the packet is complete or a timeout expires (see
+//                  sw_poll_capture()). For devices which clock faster than an
+//                  Interrupt-Handler per edge can follow. Blocks the MCU for
+//                  the length of a packet
+//
+// Highest clock-rate each mode can follow at 16 MHz. Computed from the cycle
+// counts, not measured; C, ANALYZER and MULTI are estimates of the code gcc
+// generates, and other interrupts lower all of them except POLL:
+//  SW_CAPTURE_C:        ~100 cycles per edge            ~150 kHz
+//  SW_CAPTURE_ASM:      52 cycles per edge              ~300 kHz
+//  SW_CAPTURE_SPI:      SCK < F_CPU/4, ~80 cycles/byte  ~1.5 MHz
+//  SW_CAPTURE_ANALYZER: ~150 cycles per edge            ~100 kHz
+//  SW_CAPTURE_MULTI:    ~80 cycles per edge and port    ~200 kHz / ports
+//  SW_CAPTURE_POLL:     27 cycles per bit               ~590 kHz
+#define SW_CAPTURE_C 0
+#define SW_CAPTURE_ASM 1
+#define SW_CAPTURE_SPI 2
+#define SW_CAPTURE_ANALYZER 3
+#define SW_CAPTURE_MULTI 4
+#define SW_CAPTURE_POLL 5
+#define SW_CAPTURE_MODE SW_CAPTURE_C
+
+// The SPI-Pins used by SW_CAPTURE_SPI
+// The Clock-Line (SUBD-Pin 2) needs to be connected to SCK and the Data-Line
+// (SUBD-Pin 7) to MOSI instead of the SW_CLK- and SW_DTA-Pins. SS has to be tied
+// to GND, the SPI is switched on and off via SPE instead.
+#define SW_SPI_DDR DDRB
+#define SW_SPI_PIN PINB
+#define SW_SPI_SCK_P PB1
+#define SW_SPI_MOSI_P PB2
+#define SW_SPI_SS_P PB0
+
+// The Input-Capture-Pin used by SW_CAPTURE_ANALYZER
+// The Clock-Line (SUBD-Pin 2) needs to be connected to ICP5 instead of the
+// SW_CLK-Pin, the Data-Line stays on the SW_DTA-Pin
+#define SW_ICP_DDR DDRL
+#define SW_ICP_PIN PINL
+#define SW_ICP_P PL1
+
+// Timeouts of SW_CAPTURE_POLL: for the leading falling edge after releasing
+// the trigger and between two edges. The polling loops take 6 cycles per turn
+#define SW_POLL_START_US 500
+#define SW_POLL_EDGE_US 50
+#define SW_POLL_US_TO_LOOPS(us) ((uint16_t)((us) * (F_CPU / 1000000UL) / 6))
+
+// Sampling of the data-line by SW_CAPTURE_C
+// The data-line is valid on both edges of the clock. SW_SAMPLE_EDGE selects
+// the edge(s) a bit is read on, SW_SAMPLE_VOTES the number of reads of the
+// data-line per edge. The majority of all reads of a bit decides, so an odd
+// number should be used; with both edges ties go to the reads of the falling
+// one. Bits whose reads disagree are counted as noisy (see sw_stats_t).
+// The clock idles high, so a frame starts with a falling edge which belongs
+// to no bit, and the falling edge of a bit is the one after its rising edge.
+// The last bit has no falling edge, it is read on its rising edge only.
+// Both non-default settings interrupt on every edge. More edges and reads
+// buy timing margin on long cables at the price of a longer Interrupt-Handler
+#define SW_EDGE_RISING 0
+#define SW_EDGE_FALLING 1
+#define SW_EDGE_BOTH 2
+#define SW_SAMPLE_EDGE SW_EDGE_RISING
+#define SW_SAMPLE_VOTES 1
+
+// The Pins used by SW_CAPTURE_MULTI
+// Port n gets its Clock-Line on INT(4+n) (PE4-PE7), its Trigger-Line on
+// bit n and its Data-Line on bit n+4 of SW_MULTI_PORT. Having all triggers on
+// one register allows pulling and releasing them with a single write.
+// Beware that PE6 and PE7 are not routed to the headers of the ArduinoMega.
+#define SW_PORTS 4
+#define SW_MULTI_DDR DDRA
+#define SW_MULTI_PORT PORTA
+#define SW_MULTI_PIN PINA
+
+// ticks of timer 1 between releasing the triggers of two ports, so their
+// clock-edges do not collide. 0 releases all triggers at once
+#define SW_MULTI_STAGGER_CT SW_US_TO_TICKS(100)
+
+// trigger-bits and INTn-bits of all ports
+#define SW_MULTI_TRIG_MASK ((1 << SW_PORTS) - 1)
+#define SW_MULTI_INT_MASK (SW_MULTI_TRIG_MASK << INT4)
+
+// the shortest time the trigger is kept released in SW_SCHED_FIXED.
+// With SW_CAPTURE_MULTI the staggered releases from TIMER1_COMPB have to
+// fit into it: a compare-value beyond OCR1A never matches, as the counter
+// is cleared first. The release itself happens up to ~50us after the match
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI && SW_MULTI_STAGGER_CT > 0
+#define SW_SCHED_MIN_HIGH_CT ((SW_PORTS - 1) * SW_MULTI_STAGGER_CT + SW_US_TO_TICKS(50))
+#else
+#define SW_SCHED_MIN_HIGH_CT SW_SCHED_MIN_GUARD_CT
+#endif
+
 // data structure as sent from my sidewinder device, 48 bits total
 // this datatype is accessable via two ways: an integer-array and a struct
 // the former is used to used to manipulate the data at a bit-level
@@ -78,6 +266,79 @@ typedef union
 	uint8_t bytes[6];
 } sw_data_t;
 
+// bits of the change-mask returned by sw_diff(), one per field of sw_data_t
+// the buttons of the first byte keep their position, so it can be used as is
+#define SW_CHG_FIRE BIT(0)
+#define SW_CHG_TOP BIT(1)
+#define SW_CHG_TOP_UP BIT(2)
+#define SW_CHG_TOP_DOWN BIT(3)
+#define SW_CHG_A BIT(4)
+#define SW_CHG_B BIT(5)
+#define SW_CHG_C BIT(6)
+#define SW_CHG_D BIT(7)
+#define SW_CHG_SHIFT BIT(8)
+#define SW_CHG_X BIT(9)
+#define SW_CHG_Y BIT(10)
+#define SW_CHG_M BIT(11)
+#define SW_CHG_R BIT(12)
+#define SW_CHG_HEAD BIT(13)
+
+// bits of the fields in sw_data_t.bytes[], derived from the layout above
+// fields crossing a byte boundary have a mask for each byte
+#define SW_MASK1_SHIFT 0x01
+#define SW_MASK1_X 0xFE
+#define SW_MASK2_X 0x07
+#define SW_MASK2_Y 0xF8
+#define SW_MASK3_Y 0x1F
+#define SW_MASK3_M 0xE0
+#define SW_MASK4_M 0x0F
+#define SW_MASK4_R 0xF0
+#define SW_MASK5_R 0x03
+#define SW_MASK5_HEAD 0x3C
+
+// buttons in sw_state_t.btns, at the same level as sent by the device
+#define SW_BTN_FIRE BIT(0)
+#define SW_BTN_TOP BIT(1)
+#define SW_BTN_TOP_UP BIT(2)
+#define SW_BTN_TOP_DOWN BIT(3)
+#define SW_BTN_A BIT(4)
+#define SW_BTN_B BIT(5)
+#define SW_BTN_C BIT(6)
+#define SW_BTN_D BIT(7)
+#define SW_BTN_SHIFT BIT(8)
+
+// positions of the hat-switch, values 9-15 of sw_data_t.head read as centered
+typedef enum
+{
+	SW_HAT_CENTER = 0,
+	SW_HAT_UP,
+	SW_HAT_UP_RIGHT,
+	SW_HAT_RIGHT,
+	SW_HAT_DOWN_RIGHT,
+	SW_HAT_DOWN,
+	SW_HAT_DOWN_LEFT,
+	SW_HAT_LEFT,
+	SW_HAT_UP_LEFT
+} sw_hat_t;
+
+// directions of a hat-position, see sw_hat_dirs[]
+#define SW_DIR_UP BIT(0)
+#define SW_DIR_RIGHT BIT(1)
+#define SW_DIR_DOWN BIT(2)
+#define SW_DIR_LEFT BIT(3)
+
+// a packet unpacked once into naturally aligned fields (see sw_decode()),
+// so the readers do not have to extract the bitfields again and again
+typedef struct
+{
+	uint16_t x;     // 0-1023
+	uint16_t y;     // 0-1023
+	uint16_t m;     // 0-127
+	uint16_t r;     // 0-63
+	uint16_t btns;  // SW_BTN_* bits
+	uint8_t hat;    // sw_hat_t
+} sw_state_t;
+
 
 
 // empty instance of the struct to reset our data-variable
@@ -86,15 +347,374 @@ static const sw_data_t sw_data_empty;        // 6 bytes ram
 // internal state of the interface
 volatile uint8_t sw_timer_state = SW_TIMING_ENABLE; // 1 byte ram
 
+// scheduling of the trigger
+volatile uint8_t sw_sched_mode = SW_SCHED_DEFAULT; // 1 byte ram
+
+// time to wait with the trigger released (SW_SCHED_LEGACY), period from
+// trigger to trigger (SW_SCHED_FIXED)
+// or guard time after the last bit (SW_SCHED_BACK_TO_BACK), in ticks
+volatile uint16_t sw_sched_ct = SW_TIMING_ENABLE_CT; // 2 bytes ram
+
+// lower 16 bits of sw_time when the trigger was pulled
+volatile uint16_t sw_pull_time = 0;             // 2 bytes ram
+
 // next awaited bit index
 volatile uint8_t sw_bitcnt = 0;                 // 1 byte ram
 
-// currently valid data
-volatile sw_data_t sw_dta = {};                 // 6 bytes ram
+// sw_bitcnt while waiting for the ready-edge
+#define SW_BITCNT_READY 0xFF
+
+// bits the C capture-handler accepts before the frame is ended
+#if SW_BURST
+#define SW_FRAME_BITS (SW_BURST_BYTES * 8)
+#else
+#define SW_FRAME_BITS 48
+#endif
+
+#if SW_BURST
+#if SW_CAPTURE_MODE != SW_CAPTURE_C && SW_CAPTURE_MODE != SW_CAPTURE_ASM
+#error "SW_BURST needs SW_CAPTURE_C or SW_CAPTURE_ASM"
+#endif
+#if SW_FRAME_BITS >= SW_BITCNT_READY
+#error "SW_BURST_MAX_DEVICES is too large for the bit-counter"
+#endif
+
+// a complete burst
+typedef struct
+{
+	uint8_t bytes[SW_BURST_BYTES];
+	uint8_t bits;
+	uint16_t seq;
+} sw_burst_t;
+
+// ping-pong burst buffer, works like sw_buf
+volatile sw_burst_t sw_burst_buf[2];            // 2 * (SW_BURST_BYTES + 3) bytes ram
+volatile uint8_t sw_burst_front = 0;            // 1 byte ram
+volatile uint8_t sw_burst_pubcnt = 0;           // 1 byte ram
+uint16_t sw_burst_seq = 0;                      // 2 bytes ram
+
+// device-types known to sw_burst_decode()
+#define SW_DEV_UNKNOWN 0
+#define SW_DEV_PRECISION_PRO 1
+#define SW_DEV_GAMEPAD 2
+
+// the data of a single device, split from a burst
+typedef struct
+{
+	uint8_t type;
+	uint8_t bits;
+	uint8_t bytes[8];
+} sw_device_t;
+
+// packet-lengths of the known devices, a burst is split into the first
+// length it is a multiple of
+static const uint8_t sw_dev_lengths[][2] PROGMEM = {
+	{48, SW_DEV_PRECISION_PRO},
+	{15, SW_DEV_GAMEPAD},
+};
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+// statistics collected by the protocol-analyzer
+// all times are in ticks of timer 5, 62.5ns
+typedef struct
+{
+	// packets analyzed
+	uint16_t packets;
+
+	// time between two edges of the same packet
+	uint16_t period_min;
+	uint16_t period_max;
+
+	// sum and number of the periods, mean = period_sum / period_cnt
+	uint32_t period_sum;
+	uint32_t period_cnt;
+
+	// time from the last edge of a packet to the first edge of the next
+	uint32_t gap_min;
+	uint32_t gap_max;
+	uint32_t gap_last;
+} sw_an_stats_t;
+
+volatile sw_an_stats_t sw_an_stats;             // 26 bytes ram
+
+// timestamps of all edges of the packet currently captured
+volatile uint16_t sw_an_edges[48];              // 96 bytes ram
+
+// mask of the next bit in sw_cap->bytes[sw_bitcnt / 8]
+volatile uint8_t sw_an_mask;                    // 1 byte ram
+
+// overflows of timer 5, upper half of the 32-bit timestamps
+volatile uint16_t sw_an_ovf = 0;                // 2 bytes ram
+
+// 32-bit timestamp of the last edge of the last packet, 0 before the first one
+volatile uint32_t sw_an_last_edge = 0;          // 4 bytes ram
+#endif
+
+// a complete packet, numbered in the order of reception
+typedef struct
+{
+	sw_data_t data;
+
+	// data decoded on reception
+	sw_state_t state;
+
+	uint16_t seq;
+
+	// time of reception in timer-ticks of 0.5us (see sw_now())
+	uint32_t time;
+
+	// gameport the packet was received on, always 0 unless SW_CAPTURE_MULTI
+	uint8_t port;
+} sw_packet_t;
+
+// ping-pong packet buffer
+// sw_buf[sw_front] holds the last complete packet, the capture writes into the
+// other one. A complete packet is published by flipping sw_front, so the reader
+// never sees a half written or cleared packet and never has to disable interrupts
+volatile sw_packet_t sw_buf[2];                 // 48 bytes ram
+volatile uint8_t sw_front = 0;                  // 1 byte ram
+
+// incremented on every publish, lets the reader detect a publish during its copy
+volatile uint8_t sw_pubcnt = 0;                 // 1 byte ram
+
+// sequence number of the last published packet, 0 is never used
+uint16_t sw_seq = 0;                            // 2 bytes ram
+
+// data-storage the capture is currently writing to (sw_buf[!sw_front])
+volatile sw_data_t *sw_cap = &sw_buf[1].data;   // 2 bytes ram
+
+// the bytes the bit-wise capture-handlers write to
+// sw_cap->bytes or, with SW_BURST, sw_burst_buf[!sw_burst_front].bytes
+volatile uint8_t *sw_cap_bytes = sw_buf[1].data.bytes; // 2 bytes ram
+
+// number of packets the ring-buffer can hold, needs to be a power of two
+#define SW_RING_SIZE 16
+
+// single-producer/single-consumer ring of all received packets
+// the packet-complete path writes at sw_ring_head, the main loop reads at
+// sw_ring_tail. Both only ever increment their index, the ring is empty when
+// they are equal and full when they are SW_RING_SIZE apart
+volatile sw_packet_t sw_ring[SW_RING_SIZE];     // 384 bytes ram
+volatile uint8_t sw_ring_head = 0;              // 1 byte ram
+volatile uint8_t sw_ring_tail = 0;              // 1 byte ram
+
+// number of packets dropped because the ring was full
+volatile uint16_t sw_ring_overflows = 0;        // 2 bytes ram
+
+// timer-ticks passed up to the last compare-match of timer 1
+volatile uint32_t sw_time = 0;                  // 4 bytes ram
+
+#if SW_READY_EDGE
+// current guard-time between the ready-edge and releasing the trigger
+volatile uint16_t sw_ready_guard_ct = SW_READY_GUARD_MAX_CT; // 2 bytes ram
+
+// busy-time measured on the last trigger (from pulling the trigger to the ready-edge)
+// 0 if the ready-edge was not seen
+volatile uint16_t sw_ready_busy_ct = 0;         // 2 bytes ram
+
+// number of triggers on which the ready-edge was not seen
+volatile uint16_t sw_ready_timeouts = 0;        // 2 bytes ram
+
+// sequence number at the last trigger released by the ready-edge,
+// used to see if the packet following it completed
+uint16_t sw_ready_seq = 0;                      // 2 bytes ram
+uint8_t sw_ready_released = 0;                  // 1 byte ram
+#endif
+
+#if SW_CAPTURE_MODE != SW_CAPTURE_C && (SW_SAMPLE_EDGE != SW_EDGE_RISING || SW_SAMPLE_VOTES != 1)
+#error "SW_SAMPLE_EDGE and SW_SAMPLE_VOTES are only supported with SW_CAPTURE_C"
+#endif
+
+#if SW_SAMPLE_VOTES < 1 || SW_SAMPLE_VOTES > 15
+#error "SW_SAMPLE_VOTES has to be 1 to 15"
+#endif
+
+#if SW_SAMPLE_EDGE != SW_EDGE_RISING
+// the edge INT5 expects next
+#define SW_NEXT_LEAD 0 // the falling edge starting a frame
+#define SW_NEXT_RISE 1
+#define SW_NEXT_FALL 2
+volatile uint8_t sw_edge = SW_NEXT_LEAD;        // 1 byte ram
+
+// reads of the data-line which were high on the rising edge of the current bit
+volatile uint8_t sw_votes = 0;                  // 1 byte ram
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_ASM
+// the naked handler is pointed to this byte with the mask at its last bit
+// while waiting for the ready-edge or for edges after a complete packet,
+// so the next edge runs into its completion-path
+volatile uint8_t sw_asm_sink;                   // 1 byte ram
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+// next awaited byte index
+volatile uint8_t sw_bytecnt = 0;                // 1 byte ram
+#endif
+
+// integrity of the received frames
+typedef struct
+{
+	// frames passed on to the consumer, overlong ones included
+	uint16_t accepted;
+
+	// complete frames with a wrong parity
+	uint16_t parity_errors;
+
+	// frames with less than 48 bits before the next trigger
+	uint16_t short_frames;
+
+	// frames with more than 48 bits before the next trigger. The extra edges
+	// only come after the first 48 bits were published, so these frames are
+	// not rejected and are counted in accepted as well.
+	// With SW_BURST: bursts longer than SW_BURST_MAX_DEVICES * 64 bits
+	uint16_t overlong_frames;
+
+	// triggers not answered with a single bit
+	uint16_t timeouts;
+
+	// bits whose reads of the data-line disagreed (SW_SAMPLE_VOTES)
+	uint16_t noisy_bits;
+} sw_stats_t;
+
+volatile sw_stats_t sw_stats;                   // 12 bytes ram
+
+// set when the capture of the current frame is complete
+// starts out set, as there is no frame before the first trigger
+volatile uint8_t sw_frame_done = 1;             // 1 byte ram
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+#if SW_PORTS < 1 || SW_PORTS > 4
+#error "SW_CAPTURE_MULTI supports 1 to 4 ports"
+#endif
+
+// state of one gameport with SW_CAPTURE_MULTI
+typedef struct
+{
+	// capture: byte currently written, mask of the next bit in it and bits so far
+	volatile uint8_t *ptr;
+	uint8_t mask;
+	uint8_t bitcnt;
+
+	// set when the capture of the current frame is complete
+	uint8_t done;
+
+	// ping-pong packet buffer, works like sw_buf
+	sw_packet_t buf[2];
+	uint8_t front;
+	uint8_t pubcnt;
+	uint16_t seq;
+
+	sw_stats_t stats;
+} sw_port_t;
+
+volatile sw_port_t sw_ports[SW_PORTS];          // 69 bytes ram per port
+
+// ports still capturing, when it gets 0 the frame is complete
+volatile uint8_t sw_multi_pending = 0;          // 1 byte ram
+
+// next port to release with staggered triggers
+volatile uint8_t sw_multi_next = 0;             // 1 byte ram
+#endif
+
+// sw_hat_t of each value of sw_data_t.head
+static const uint8_t sw_hat_tab[16] PROGMEM = {
+	SW_HAT_CENTER, SW_HAT_UP, SW_HAT_UP_RIGHT, SW_HAT_RIGHT,
+	SW_HAT_DOWN_RIGHT, SW_HAT_DOWN, SW_HAT_DOWN_LEFT, SW_HAT_LEFT,
+	SW_HAT_UP_LEFT, SW_HAT_CENTER, SW_HAT_CENTER, SW_HAT_CENTER,
+	SW_HAT_CENTER, SW_HAT_CENTER, SW_HAT_CENTER, SW_HAT_CENTER
+};
+
+// SW_DIR_* bits of each sw_hat_t
+static const uint8_t sw_hat_dirs[9] PROGMEM = {
+	0,
+	SW_DIR_UP,
+	SW_DIR_UP | SW_DIR_RIGHT,
+	SW_DIR_RIGHT,
+	SW_DIR_DOWN | SW_DIR_RIGHT,
+	SW_DIR_DOWN,
+	SW_DIR_DOWN | SW_DIR_LEFT,
+	SW_DIR_LEFT,
+	SW_DIR_UP | SW_DIR_LEFT
+};
+
+// parity of a nibble
+static const uint8_t sw_parity_tab[16] PROGMEM = {
+	0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0
+};
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_ASM
+// state of the naked capture handler, bound to registers gcc does not allocate:
+// the bindings below keep it off them in this compilation unit and the
+// Makefile passes -ffixed-r2 to -ffixed-r5 for everything else it compiles.
+// Prebuilt library code (libgcc, avr-libc) was compiled without those flags
+// and may still save and use r2-r5, e.g. in 32-bit division or ultoa().
+// If the capture-interrupt hits such a routine it writes through a garbage
+// pointer. The linked libraries have not been checked; `make regcheck` lists
+// every function in the image touching r2-r5, only those working with the
+// variables below should.
+// This needs to be seen before any function is compiled, which is why
+// sidewinder.c is the first file included by firmware.c
+register volatile uint8_t *sw_asm_ptr asm("r2"); // r2:r3, byte currently written
+register uint8_t sw_asm_mask asm("r4");          // mask of the next bit in that byte
+register uint8_t sw_asm_end asm("r5");           // low byte of the pointer behind the last byte
+#endif
+
+
+
+
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+// start collecting new statistics
+void sw_an_reset_stats(void)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	sw_an_stats.packets = 0;
+	sw_an_stats.period_min = 0xFFFF;
+	sw_an_stats.period_max = 0;
+	sw_an_stats.period_sum = 0;
+	sw_an_stats.period_cnt = 0;
+	sw_an_stats.gap_min = 0xFFFFFFFF;
+	sw_an_stats.gap_max = 0;
+	sw_an_stats.gap_last = 0;
+
+	SREG = sreg_tmp;
+}
+
+// copy the statistics collected so far
+void sw_an_get_stats(sw_an_stats_t *st)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	*st = sw_an_stats;
+
+	SREG = sreg_tmp;
+}
 
+// copy the 48 edge-timestamps of the last complete packet
+// returns 0 if the capture of the next packet already started
+uint8_t sw_an_get_edges(uint16_t *edges)
+{
+	uint8_t ok = 0;
+	uint8_t sreg_tmp = SREG;
+	cli();
 
+	if(sw_bitcnt == 48)
+	{
+		for(uint8_t i = 0; i < 48; i++)
+			edges[i] = sw_an_edges[i];
 
+		ok = 1;
+	}
 
+	SREG = sreg_tmp;
+	return ok;
+}
+#endif
 
 // setup pins & ports for communicating with the sidewinder device
 void sw_setup_lines(void)
@@ -108,17 +728,69 @@ void sw_setup_lines(void)
 	SETBIT(SW_CLKINDI_DDR, SW_CLKINDI_P);
 
 
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+	// trigger-lines as output & high, data-lines as input
+	SETBITS(SW_MULTI_DDR, SW_MULTI_TRIG_MASK);
+	CLEARBITS(SW_MULTI_DDR, SW_MULTI_TRIG_MASK << 4);
+	SETBITS(SW_MULTI_PORT, SW_MULTI_TRIG_MASK);
+
+	// clock-lines as input
+	CLEARBITS(DDRE, SW_MULTI_TRIG_MASK << PE4);
+
+	// enable rising edge detection for INT4-INT7
+	EICRB = 0xFF;
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	// clock- & data-line as input
+	CLEARBIT(SW_ICP_DDR, SW_ICP_P);
+	CLEARBIT(SW_DTA_DDR, SW_DTA_P);
+
+	// timer 5 free running without prescaler, capture on the rising edge
+	TCCR5A = 0;
+	TCCR5B = BIT(ICES5) | BIT(CS50);
+
+	// count its overflows to extend the timestamps to 32 bit
+	SETBIT(TIMSK5, TOIE5);
+
+	sw_an_reset_stats();
+#elif SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	// clock-, data- & slave-select-line as input
+	CLEARBITS(SW_SPI_DDR, BIT(SW_SPI_SCK_P) | BIT(SW_SPI_MOSI_P) | BIT(SW_SPI_SS_P));
+
+	// slave mode, lsb first (the device sends the lowest bit first),
+	// sample on the rising edge (mode 0), interrupt on every complete byte.
+	// SPE is set when the trigger is released
+	SPCR = BIT(SPIE) | BIT(DORD);
+
+#if SW_READY_EDGE
+	// pin-change interrupts of port b, SCK is unmasked while waiting for the ready-edge
+	SETBIT(PCICR, PCIE0);
+#endif
+#else
 	// clock- & data-line as input
 	CLEARBIT(SW_CLK_DDR, SW_CLK_P);
 	CLEARBIT(SW_DTA_DDR, SW_DTA_P);
 
+#if SW_SAMPLE_EDGE != SW_EDGE_RISING
+	// enable detection of both edges for INT5
+	SETBIT(EICRB, ISC50);
+#elif SW_CAPTURE_MODE != SW_CAPTURE_POLL
 	// enable rising edge detection for INT5
 	SETBITS(EICRB, BIT(ISC51) | BIT(ISC50));
+#endif
+#endif
 }
 
 // setup timer/compare module to trigger every 5ms (at 200Hz)
 void sw_setup_timer(void)
 {
+#if SW_BURST
+	// timer 2 detects the end of a burst, prescaler 32 (2us per tick).
+	// Its compare-interrupt is enabled while capturing
+	TCCR2A = 0;
+	TCCR2B = BIT(CS21) | BIT(CS20);
+	OCR2A = SW_BURST_GAP_CT;
+#endif
+
 	// prescaler to 8
 	SETBITS(TCCR1B, BIT(CS11));
 
@@ -126,7 +798,7 @@ void sw_setup_timer(void)
 	SETBIT(TCCR1B, WGM12);
 
 	// set output-compare-value
-	OCR1A = SW_TIMING_ENABLE_CT;
+	OCR1A = sw_sched_ct;
 
 	// enable output-compare interrupt (timer 0, compare A)
 	SETBIT(TIMSK1, OCIE1A);
@@ -145,110 +817,1536 @@ void sw_setup(void)
 
 
 
-// evers 3ms (at 333Hz)
-ISR(TIMER1_COMPA_vect)
+// select how the trigger is scheduled
+//  SW_SCHED_LEGACY:       ticks is ignored
+//  SW_SCHED_FIXED:        ticks is the period from trigger to trigger
+//  SW_SCHED_BACK_TO_BACK: ticks is the guard time between the last bit of a
+//                         packet and the next trigger
+// use SW_US_TO_TICKS() to convert from microseconds.
+// The new schedule takes effect with the next trigger
+void sw_set_schedule(uint8_t mode, uint16_t ticks)
 {
+	uint16_t ct = ticks;
+
+	if(mode == SW_SCHED_LEGACY)
+		ct = SW_TIMING_ENABLE_CT;
+
+	// the period includes the time the trigger is held low. That time is
+	// only known when it is released, the timer-ISR subtracts it there and
+	// stretches periods too short for SW_SCHED_MIN_HIGH_CT
+	else if(ct < SW_SCHED_MIN_GUARD_CT)
+		ct = SW_SCHED_MIN_GUARD_CT;
+
+	else if(mode == SW_SCHED_BACK_TO_BACK && ct > SW_SCHED_MAX_GUARD_CT)
+		ct = SW_SCHED_MAX_GUARD_CT;
+
 	uint8_t sreg_tmp = SREG;
 	cli();
 
-	// execute an enable cycle (pull line low)
-	if(sw_timer_state == SW_TIMING_ENABLE)
+	sw_sched_mode = mode;
+	sw_sched_ct = ct;
+
+	SREG = sreg_tmp;
+}
+
+// current time in timer-ticks of 0.5us, wraps after ~35 minutes
+// only to be called with interrupts disabled
+static inline uint32_t sw_now_isr(void)
+{
+	uint16_t t = TCNT1;
+	uint32_t now = sw_time;
+
+	// the timer already matched but its interrupt did not yet run
+	if(BITSET(TIFR1, OCF1A))
 	{
-		// set the time the timer should timing-line should stay low
-		OCR1A = SW_TIMING_READING_CT;
+		t = TCNT1;
+		now += OCR1A + 1;
+	}
 
-		// switch modes
-		sw_timer_state = SW_TIMING_READING;
+	return now + t;
+}
+
+// current time in timer-ticks of 0.5us, wraps after ~35 minutes
+uint32_t sw_now(void)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
 
-		// disable external interrupt 5
-		CLEARBIT(EIMSK, INT5);
+	uint32_t now = sw_now_isr();
 
-		// pull timing line down
-		CLEARBIT(SW_TIMING_PORT, SW_TIMING_P);
+	SREG = sreg_tmp;
+	return now;
+}
+
+// copy up to max packets from the ring into pkts, oldest first
+// returns the number of packets copied
+uint8_t sw_ring_read(sw_packet_t *pkts, uint8_t max)
+{
+	uint8_t tail = sw_ring_tail, n = 0;
+
+	while(n < max && tail != sw_ring_head)
+	{
+		pkts[n++] = sw_ring[tail % SW_RING_SIZE];
+		tail++;
 	}
 
-	// with the act of releasing the line high again,
-	// the device begins transmitting data
-	else
+	// hand the slots back to the producer
+	sw_ring_tail = tail;
+	return n;
+}
+
+// number of packets dropped because the ring was full
+uint16_t sw_ring_get_overflows(void)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	uint16_t n = sw_ring_overflows;
+
+	SREG = sreg_tmp;
+	return n;
+}
+
+// copy the frame integrity counters
+void sw_get_stats(sw_stats_t *st)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	*st = sw_stats;
+
+	SREG = sreg_tmp;
+}
+
+#if SW_READY_EDGE
+// read the state of the ready-edge detection
+// busy_ct: busy-time of the last trigger in ticks, 0 if the ready-edge was not seen
+// guard_ct: current guard-time in ticks
+// returns the number of triggers on which the ready-edge was not seen
+uint16_t sw_ready_get_stats(uint16_t *busy_ct, uint16_t *guard_ct)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	*busy_ct = sw_ready_busy_ct;
+	*guard_ct = sw_ready_guard_ct;
+	uint16_t n = sw_ready_timeouts;
+
+	SREG = sreg_tmp;
+	return n;
+}
+#endif
+
+#if SW_BURST
+// copy the last complete burst
+// returns 0 if no burst has been received so far
+uint8_t sw_get_burst(sw_burst_t *b)
+{
+	uint8_t cnt;
+
+	do
 	{
-		// set the time the timer should timing-line should stay high
-		OCR1A = SW_TIMING_ENABLE_CT;
+		cnt = sw_burst_pubcnt;
+		*b = sw_burst_buf[sw_burst_front];
+	}
+	while(cnt != sw_burst_pubcnt);
 
-		// switch modes
-		sw_timer_state = SW_TIMING_ENABLE;
+	return b->seq != 0;
+}
 
-		// send a callback that the data will become invalid now
-		sw_data_is_now_invalid();
+// split a burst into the records of the devices that sent it
+// returns the number of records written to devs, at most max
+uint8_t sw_burst_decode(const sw_burst_t *b, sw_device_t *devs, uint8_t max)
+{
+	uint8_t len = 0, type = SW_DEV_UNKNOWN, n = 0;
 
-		// show state on output port
-		CLEARBIT(SW_RCVINDI_PORT, SW_RCVINDI_P);
+	if(b->bits == 0)
+		return 0;
+
+	// find the device-type from the length
+	for(uint8_t i = 0; i < sizeof(sw_dev_lengths) / sizeof(sw_dev_lengths[0]); i++)
+	{
+		uint8_t l = pgm_read_byte(&sw_dev_lengths[i][0]);
+		if(b->bits % l == 0)
+		{
+			len = l;
+			type = pgm_read_byte(&sw_dev_lengths[i][1]);
+			break;
+		}
+	}
 
-		// clear data storage
-		sw_dta = sw_data_empty;
-		sw_bitcnt = 0;
+	// unknown length, pass the burst as a single record
+	if(len == 0 || len > 64)
+		len = b->bits > 64 ? 64 : b->bits;
 
-		// clear INT5 interrupt flag
-		SETBIT(EIFR, INTF5);
+	// walk the bits with rotating masks instead of variable shifts
+	const uint8_t *src = b->bytes;
+	uint8_t smask = BIT(0);
 
-		// enable external interrupt INT5
-		SETBIT(EIMSK, INT5);
+	for(uint8_t bit = 0; bit + len <= b->bits && n < max; bit += len, n++)
+	{
+		sw_device_t *d = &devs[n];
+		uint8_t *dst = d->bytes, dmask = BIT(0);
 
-		// release timing line high again
-		SETBIT(SW_TIMING_PORT, SW_TIMING_P);
+		d->type = type;
+		d->bits = len;
+		for(uint8_t j = 0; j < sizeof(d->bytes); j++)
+			d->bytes[j] = 0;
+
+		for(uint8_t j = 0; j < len; j++)
+		{
+			if(*src & smask)
+				*dst |= dmask;
+
+			if(!(smask <<= 1)) { smask = BIT(0); src++; }
+			if(!(dmask <<= 1)) { dmask = BIT(0); dst++; }
+		}
 	}
 
-	// restore system state
+	return n;
+}
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+// copy the last complete packet of a gameport
+// returns 0 if no packet has been received on it so far
+uint8_t sw_port_get_packet(uint8_t port, sw_packet_t *pkt)
+{
+	volatile sw_port_t *p = &sw_ports[port];
+	uint8_t cnt;
+
+	do
+	{
+		cnt = p->pubcnt;
+		*pkt = p->buf[p->front];
+	}
+	while(cnt != p->pubcnt);
+
+	return pkt->seq != 0;
+}
+
+// copy the frame integrity counters of a gameport
+void sw_port_get_stats(uint8_t port, sw_stats_t *st)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	*st = sw_ports[port].stats;
+
 	SREG = sreg_tmp;
 }
+#endif
+
+// copy the last complete packet
+// returns 0 if no packet has been received so far
+// compare pkt->seq with the one from the last call to find out if it is a new one
+uint8_t sw_get_packet(sw_packet_t *pkt)
+{
+	uint8_t cnt;
+
+	// if a packet got published while copying, the buffer we are reading from
+	// may be reused by the capture, so try again
+	do
+	{
+		cnt = sw_pubcnt;
+		*pkt = sw_buf[sw_front];
+	}
+	while(cnt != sw_pubcnt);
+
+	return pkt->seq != 0;
+}
 
+// the last complete packet
+// only safe to use from within sw_data_is_now_valid(), all other code should use sw_get_packet()
+// with SW_CAPTURE_MULTI this is the one of port 0
+static inline volatile sw_packet_t *sw_last_packet(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+	return &sw_ports[0].buf[sw_ports[0].front];
+#else
+	return &sw_buf[sw_front];
+#endif
+}
 
+// the data of the last complete packet, same rules as for sw_last_packet()
+static inline volatile sw_data_t *sw_last_data(void)
+{
+	return &sw_last_packet()->data;
+}
 
+// unpack a packet into a sw_state_t
+// only constant shifts by whole bytes and nibbles, no bitfield accesses,
+// the masks are the ones used by sw_diff()
+static inline void sw_decode(volatile const sw_data_t *d, volatile sw_state_t *st)
+{
+	uint8_t b1 = d->bytes[1], b2 = d->bytes[2], b3 = d->bytes[3], b4 = d->bytes[4], b5 = d->bytes[5];
+
+	st->x = (b1 >> 1) | ((uint16_t)(b2 & SW_MASK2_X) << 7);
+	st->y = (b2 >> 3) | ((uint16_t)(b3 & SW_MASK3_Y) << 5);
+	st->m = (b3 >> 5) | ((b4 & SW_MASK4_M) << 3);
+	st->r = (b4 >> 4) | ((b5 & SW_MASK5_R) << 4);
+	st->btns = d->bytes[0] | ((uint16_t)(b1 & SW_MASK1_SHIFT) << 8);
+	st->hat = pgm_read_byte(&sw_hat_tab[(b5 & SW_MASK5_HEAD) >> 2]);
+}
 
+// SW_DIR_* bits of a hat-position
+static inline uint8_t sw_hat_dir(uint8_t hat)
+{
+	return pgm_read_byte(&sw_hat_dirs[hat]);
+}
 
-// Interrupt-Handler for external Interrupt INT5
-ISR(INT5_vect)
+// the decoded last complete packet, same rules as for sw_last_packet()
+static inline volatile sw_state_t *sw_last_state(void)
 {
+	return &sw_last_packet()->state;
+}
 
-	if(sw_bitcnt > 48) return;
+// compare two packets
+// returns a mask of SW_CHG_* bits of the fields which differ
+//
+// Comparing the bitfields one by one costs a shift-and-mask extraction of
+// both sides per field, so the bytes are xored once and the fields are looked
+// up in the differences with constant masks instead
+uint16_t sw_diff(const sw_data_t *a, const sw_data_t *b)
+{
+	uint8_t d[6];
 
-	SETBIT(SW_CLKINDI_PORT, SW_CLKINDI_P);
-	CLEARBIT(SW_CLKINDI_PORT, SW_CLKINDI_P);
+	for(uint8_t i = 0; i < sizeof(d); i++)
+		d[i] = a->bytes[i] ^ b->bytes[i];
 
-	// this is slower -in fact it is too slow to keep up with the clock-
-	// because of the (pricy) relative bitshift required to generate the
-	// mask, as the avr only implements a 1-bit shift-operation.
-	// so to create a mask shifted by 48 bits, the avr loops 48 times,
-	// shifting the bit by one position.
-	/*
-	if(BITSET(SW_DTA_PIN, SW_DTA_P))
-		SETBIT(sw_dta.bits, sw_bitcnt);
-	*/
+	// buttons fire to d
+	uint16_t chg = d[0];
 
+	if(d[1] & SW_MASK1_SHIFT)
+		chg |= SW_CHG_SHIFT;
 
-	if(BITSET(SW_DTA_PIN, SW_DTA_P))
+	if((d[1] & SW_MASK1_X) || (d[2] & SW_MASK2_X))
+		chg |= SW_CHG_X;
+
+	if((d[2] & SW_MASK2_Y) || (d[3] & SW_MASK3_Y))
+		chg |= SW_CHG_Y;
+
+	if((d[3] & SW_MASK3_M) || (d[4] & SW_MASK4_M))
+		chg |= SW_CHG_M;
+
+	if((d[4] & SW_MASK4_R) || (d[5] & SW_MASK5_R))
+		chg |= SW_CHG_R;
+
+	if(d[5] & SW_MASK5_HEAD)
+		chg |= SW_CHG_HEAD;
+
+	return chg;
+}
+
+
+
+
+
+// stop listening to the clock-line
+static inline void sw_capture_stop(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	// disable the spi, this also drops a partially received byte
+	CLEARBIT(SPCR, SPE);
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	// disable the input-capture interrupt
+	CLEARBIT(TIMSK5, ICIE5);
+#elif SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+	// disable the external interrupts of all ports and the staggered release
+	CLEARBITS(EIMSK, SW_MULTI_INT_MASK);
+	CLEARBIT(TIMSK1, OCIE1B);
+#else
+	// disable external interrupt 5
+	CLEARBIT(EIMSK, INT5);
+#endif
+
+#if SW_BURST
+	// stop waiting for the end of the burst
+	CLEARBIT(TIMSK2, OCIE2A);
+#endif
+}
+
+// prepare the data storage and start listening to the clock-line
+static inline void sw_capture_start(void)
+{
+	// capture into the buffer which is not published
+	sw_cap = &sw_buf[sw_front ^ 1].data;
+	sw_frame_done = 0;
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+	for(uint8_t i = 0; i < SW_PORTS; i++)
 	{
-		volatile uint8_t *byte = &sw_dta.bytes[sw_bitcnt / 8];
+		volatile sw_port_t *p = &sw_ports[i];
+		volatile sw_data_t *d = &p->buf[p->front ^ 1].data;
+
+		*d = sw_data_empty;
+		p->ptr = d->bytes;
+		p->mask = BIT(0);
+		p->bitcnt = 0;
+		p->done = 0;
+	}
 
-		switch(sw_bitcnt % 8)
-		{
-			case 0: SETBIT(*byte, 0); break;
-			case 1: SETBIT(*byte, 1); break;
-			case 2: SETBIT(*byte, 2); break;
-			case 3: SETBIT(*byte, 3); break;
-			case 4: SETBIT(*byte, 4); break;
-			case 5: SETBIT(*byte, 5); break;
-			case 6: SETBIT(*byte, 6); break;
-			case 7: SETBIT(*byte, 7); break;
-		}
+	sw_multi_pending = SW_MULTI_TRIG_MASK;
+
+	// the interrupts are enabled together with the triggers
+	SETBITS(EIFR, SW_MULTI_INT_MASK);
+#elif SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	// the spi writes whole bytes, so there's no need to clear the storage
+	sw_bytecnt = 0;
+
+	// enable the spi
+	SETBIT(SPCR, SPE);
+#else
+#if SW_BURST
+	// clear burst storage, the capture only sets the bits which are high
+	sw_cap_bytes = sw_burst_buf[sw_burst_front ^ 1].bytes;
+	for(uint8_t i = 0; i < SW_BURST_BYTES; i++)
+		sw_cap_bytes[i] = 0;
+
+	// wait for the end of the burst
+	TCNT2 = 0;
+	SETBIT(TIFR2, OCF2A);
+	SETBIT(TIMSK2, OCIE2A);
+#else
+	// clear data storage, the capture only sets the bits which are high
+	*sw_cap = sw_data_empty;
+	sw_cap_bytes = sw_cap->bytes;
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_POLL
+	// the bits are polled from ISR(TIMER1_COMPA_vect) right after the release
+	sw_bitcnt = 0;
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	sw_bitcnt = 0;
+	sw_an_mask = BIT(0);
+
+	// clear the input-capture flag and enable its interrupt
+	SETBIT(TIFR5, ICF5);
+	SETBIT(TIMSK5, ICIE5);
+#else
+#if SW_CAPTURE_MODE == SW_CAPTURE_ASM
+	sw_asm_ptr = sw_cap_bytes;
+	sw_asm_mask = BIT(0);
+#if SW_BURST
+	sw_asm_end = (uint8_t)(uint16_t)(sw_cap_bytes + SW_BURST_BYTES);
+#else
+	sw_asm_end = (uint8_t)(uint16_t)(sw_cap_bytes + sizeof(sw_cap->bytes));
+#endif
+#else
+	sw_bitcnt = 0;
+
+#if SW_SAMPLE_EDGE != SW_EDGE_RISING
+	sw_edge = SW_NEXT_LEAD;
+
+	// back from the rising ready-edge to both edges
+	CLEARBIT(EICRB, ISC51);
+#endif
+#endif
+
+	// clear INT5 interrupt flag
+	SETBIT(EIFR, INTF5);
+
+	// enable external interrupt INT5
+	SETBIT(EIMSK, INT5);
+#endif
+#endif
+}
+
+// did the device send anything since the capture was started?
+static inline uint8_t sw_capture_started(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	// bits of an incomplete byte can not be seen
+	return sw_bytecnt != 0;
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ASM
+	return sw_asm_ptr != sw_cap_bytes || sw_asm_mask != BIT(0);
+#else
+	return sw_bitcnt != 0;
+#endif
+}
+
+#if SW_BURST
+// number of bits captured so far
+static inline uint8_t sw_capture_bits(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_ASM
+	uint8_t n = (uint8_t)(sw_asm_ptr - sw_cap_bytes) * 8;
+
+	for(uint8_t m = sw_asm_mask; m > 1; m >>= 1)
+		n++;
+
+	return n;
+#else
+	return sw_bitcnt;
+#endif
+}
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_C
+// set bit sw_bitcnt of the capture
+// the switch avoids the avr's slow shift by a variable count
+static inline void sw_set_bit(void) __attribute__((always_inline));
+static inline void sw_set_bit(void)
+{
+	volatile uint8_t *byte = &sw_cap_bytes[sw_bitcnt / 8];
 
+	switch(sw_bitcnt % 8)
+	{
+		case 0: SETBIT(*byte, 0); break;
+		case 1: SETBIT(*byte, 1); break;
+		case 2: SETBIT(*byte, 2); break;
+		case 3: SETBIT(*byte, 3); break;
+		case 4: SETBIT(*byte, 4); break;
+		case 5: SETBIT(*byte, 5); break;
+		case 6: SETBIT(*byte, 6); break;
+		case 7: SETBIT(*byte, 7); break;
 	}
+}
+#endif
 
-	if(++sw_bitcnt == 48)
+// pull the trigger-line(s) low
+static inline void sw_trigger_pull(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+	CLEARBITS(SW_MULTI_PORT, SW_MULTI_TRIG_MASK);
+#else
+	CLEARBIT(SW_TIMING_PORT, SW_TIMING_P);
+#endif
+}
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+// listen to the clock-line of a port and release its trigger
+static inline void sw_multi_release(uint8_t port)
+{
+	SETBIT(EIMSK, INT4 + port);
+	SETBIT(SW_MULTI_PORT, port);
+}
+#endif
+
+// release the trigger-line(s) high again
+static inline void sw_trigger_release(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+#if SW_MULTI_STAGGER_CT > 0
+	// release port 0 now and the others one by one from TIMER1_COMPB
+	sw_multi_release(0);
+
+	if(SW_PORTS > 1)
 	{
-		// show state on output port
-		SETBIT(SW_RCVINDI_PORT, SW_RCVINDI_P);
+		sw_multi_next = 1;
+		OCR1B = TCNT1 + SW_MULTI_STAGGER_CT;
+		SETBIT(TIFR1, OCF1B);
+		SETBIT(TIMSK1, OCIE1B);
+	}
+#else
+	// all at once
+	SETBITS(EIMSK, SW_MULTI_INT_MASK);
+	SETBITS(SW_MULTI_PORT, SW_MULTI_TRIG_MASK);
+#endif
+#else
+	SETBIT(SW_TIMING_PORT, SW_TIMING_P);
+#endif
+}
 
-		// send a callback that the data is become valid now
-		sw_data_is_now_valid();
+// account for the last frame(s) if they did not complete
+static inline void sw_account_frame(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+	for(uint8_t i = 0; i < SW_PORTS; i++)
+	{
+		volatile sw_port_t *p = &sw_ports[i];
+
+		if(!p->done)
+		{
+			if(p->bitcnt != 0)
+				p->stats.short_frames++;
+			else
+				p->stats.timeouts++;
+		}
+	}
+#else
+	if(!sw_frame_done)
+	{
+		if(sw_capture_started())
+			sw_stats.short_frames++;
+		else
+			sw_stats.timeouts++;
 	}
+#endif
+}
+
+#if SW_READY_EDGE
+// is the device pulling its clock-line low?
+static inline uint8_t sw_ready_is_busy(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	return BITCLEAR(SW_SPI_PIN, SW_SPI_SCK_P);
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	return BITCLEAR(SW_ICP_PIN, SW_ICP_P);
+#else
+	return BITCLEAR(SW_CLK_PIN, SW_CLK_P);
+#endif
+}
+
+// start listening for the rising edge of the clock-line
+static inline void sw_ready_arm(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	// the clock-line is connected to SCK, which is also PCINT1
+	SETBIT(PCIFR, PCIF0);
+	SETBIT(PCMSK0, SW_SPI_SCK_P);
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	// the capture-handler checks for SW_TIMING_BUSY itself
+	SETBIT(TIFR5, ICF5);
+	SETBIT(TIMSK5, ICIE5);
+#else
+#if SW_CAPTURE_MODE == SW_CAPTURE_ASM
+	sw_asm_ptr = &sw_asm_sink;
+	sw_asm_mask = BIT(7);
+	sw_asm_end = (uint8_t)(uint16_t)(&sw_asm_sink + 1);
+#else
+	sw_bitcnt = SW_BITCNT_READY;
+#endif
+
+#if SW_SAMPLE_EDGE != SW_EDGE_RISING
+	// the ready-edge is a rising one
+	SETBIT(EICRB, ISC51);
+#endif
+
+	// clear INT5 interrupt flag
+	SETBIT(EIFR, INTF5);
+
+	// enable external interrupt INT5
+	SETBIT(EIMSK, INT5);
+#endif
+}
+
+// stop listening for the rising edge of the clock-line
+static inline void sw_ready_disarm(void)
+{
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+	CLEARBIT(PCMSK0, SW_SPI_SCK_P);
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+	CLEARBIT(TIMSK5, ICIE5);
+#else
+	CLEARBIT(EIMSK, INT5);
+#endif
 }
+
+// adapt the guard-time to the outcome of the last ready-released trigger
+static inline void sw_ready_tune(void)
+{
+	if(!sw_ready_released)
+		return;
+
+	sw_ready_released = 0;
+
+	// the packet completed, try with a shorter guard-time
+	if(sw_ready_seq != sw_seq)
+	{
+		if(sw_ready_guard_ct >= SW_READY_GUARD_MIN_CT + SW_READY_GUARD_DOWN_CT)
+			sw_ready_guard_ct -= SW_READY_GUARD_DOWN_CT;
+	}
+
+	// it did not, back off
+	else if(sw_ready_guard_ct <= SW_READY_GUARD_MAX_CT - SW_READY_GUARD_UP_CT)
+		sw_ready_guard_ct += SW_READY_GUARD_UP_CT;
+	else
+		sw_ready_guard_ct = SW_READY_GUARD_MAX_CT;
+}
+#endif
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_POLL
+static void sw_poll_capture(void);
+#endif
+
+// evers 3ms (at 333Hz)
+ISR(TIMER1_COMPA_vect)
+{
+	uint8_t sreg_tmp = SREG;
+	cli();
+
+	// keep track of the time
+	sw_time += OCR1A + 1;
+
+	// execute an enable cycle (pull line low)
+	if(sw_timer_state == SW_TIMING_ENABLE)
+	{
+#if SW_READY_EDGE
+		// did the last packet make it with the current guard-time?
+		sw_ready_tune();
+
+		// give the device some time to signal busy
+		OCR1A = SW_READY_SETTLE_CT;
+
+		// switch modes
+		sw_timer_state = SW_TIMING_SETTLE;
+#else
+		// set the time the timer should timing-line should stay low
+		OCR1A = SW_TIMING_READING_CT;
+
+		// switch modes
+		sw_timer_state = SW_TIMING_READING;
+#endif
+
+		// stop listening to the clock-line, it dips when the trigger is pulled
+		sw_capture_stop();
+
+		// account for the last frame if it did not complete
+		sw_account_frame();
+
+		// pull timing line down
+		sw_trigger_pull();
+		sw_pull_time = (uint16_t)sw_time;
+	}
+
+#if SW_READY_EDGE
+	// the device should be busy by now
+	else if(sw_timer_state == SW_TIMING_SETTLE)
+	{
+		// hold the trigger for the rest of SW_TIMING_READING_CT at most
+		OCR1A = SW_TIMING_READING_CT - SW_READY_SETTLE_CT - 1;
+
+		if(sw_ready_is_busy())
+		{
+			// wait for the ready-edge
+			sw_timer_state = SW_TIMING_BUSY;
+			sw_ready_arm();
+		}
+		else
+		{
+			// the device did not signal busy, fall back to the fixed hold time
+			sw_timer_state = SW_TIMING_READING;
+			sw_ready_busy_ct = 0;
+			sw_ready_timeouts++;
+		}
+	}
+#endif
+
+	// with the act of releasing the line high again,
+	// the device begins transmitting data
+	else
+	{
+#if SW_READY_EDGE
+		// the ready-edge did not come, release after the fixed hold time
+		if(sw_timer_state == SW_TIMING_BUSY)
+		{
+			sw_ready_disarm();
+			sw_ready_busy_ct = 0;
+			sw_ready_timeouts++;
+		}
+#endif
+
+		// set the time the timer should timing-line should stay high
+		// in back-to-back mode the packet-complete path shortens that
+		if(sw_sched_mode == SW_SCHED_BACK_TO_BACK)
+			OCR1A = SW_SCHED_TIMEOUT_CT;
+
+		// the rest of the period, after the hold time just measured
+		else if(sw_sched_mode == SW_SCHED_FIXED)
+		{
+			uint16_t hold = (uint16_t)sw_time - sw_pull_time;
+
+			OCR1A = sw_sched_ct > hold + 1 + SW_SCHED_MIN_HIGH_CT ?
+				sw_sched_ct - hold - 1 : SW_SCHED_MIN_HIGH_CT;
+		}
+		else
+			OCR1A = sw_sched_ct;
+
+		// switch modes
+		sw_timer_state = SW_TIMING_ENABLE;
+
+		// show state on output port
+		CLEARBIT(SW_RCVINDI_PORT, SW_RCVINDI_P);
+
+		// clear data storage and listen to the clock-line
+		sw_capture_start();
+
+		// release timing line high again
+		sw_trigger_release();
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_POLL
+		// read the whole packet right here, interrupts are still masked
+		sw_poll_capture();
+#endif
+	}
+
+	// restore system state
+	SREG = sreg_tmp;
+}
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_MULTI && SW_MULTI_STAGGER_CT > 0
+// release the trigger of the next port
+ISR(TIMER1_COMPB_vect)
+{
+	uint8_t port = sw_multi_next;
+
+	sw_multi_release(port);
+
+	if(++port < SW_PORTS)
+	{
+		sw_multi_next = port;
+		OCR1B += SW_MULTI_STAGGER_CT;
+	}
+	else
+		CLEARBIT(TIMSK1, OCIE1B);
+}
+#endif
+
+
+
+
+
+#if SW_READY_EDGE
+// the device released its clock-line, it is ready to send
+// called from the clock-interrupt while in SW_TIMING_BUSY
+static inline void sw_ready_edge(void)
+{
+	sw_ready_disarm();
+
+	// the busy-timeout matched already. Moving OCR1A now would make its
+	// interrupt add the new value to sw_time, let it release the trigger
+	if(BITSET(TIFR1, OCF1A))
+		return;
+
+	// the timer was restarted SW_READY_SETTLE_CT after the trigger was pulled
+	uint16_t t = TCNT1;
+	sw_ready_busy_ct = SW_READY_SETTLE_CT + 1 + t;
+
+	// release the trigger after the guard-time
+	// the counter is not reset but the compare-value is moved, so sw_time stays exact
+	OCR1A = t + sw_ready_guard_ct;
+	sw_timer_state = SW_TIMING_READING;
+
+	// remember to check if the packet made it
+	sw_ready_seq = sw_seq;
+	sw_ready_released = 1;
+}
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+// Interrupt-Handler for a change of SCK while waiting for the ready-edge
+ISR(PCINT0_vect)
+{
+	if(sw_timer_state == SW_TIMING_BUSY && BITSET(SW_SPI_PIN, SW_SPI_SCK_P))
+		sw_ready_edge();
+}
+#endif
+#endif
+
+
+
+
+
+// check the parity of a packet
+static inline uint8_t sw_parity_ok(volatile const sw_data_t *d)
+{
+	uint8_t x = d->bytes[0] ^ d->bytes[1] ^ d->bytes[2] ^ d->bytes[3] ^ d->bytes[4] ^ d->bytes[5];
+
+	x ^= x >> 4;
+	return pgm_read_byte(&sw_parity_tab[x & 0x0F]) == SW_PARITY_ODD;
+}
+
+// append a packet to the ring, drop it if the ring is full
+static inline void sw_ring_push(volatile sw_packet_t *pkt)
+{
+	uint8_t head = sw_ring_head;
+
+	if((uint8_t)(head - sw_ring_tail) < SW_RING_SIZE)
+	{
+		sw_ring[head % SW_RING_SIZE] = *pkt;
+		sw_ring_head = head + 1;
+	}
+	else
+		sw_ring_overflows++;
+}
+
+// the device finished sending
+static inline void sw_frame_complete(void)
+{
+	sw_frame_done = 1;
+
+	// re-arm the timer to trigger again after the guard time.
+	// The counter is not reset but the compare-value is moved, so sw_time stays exact
+	if(sw_sched_mode != SW_SCHED_BACK_TO_BACK)
+		return;
+
+	// the timeout matched already, the trigger is due anyway and sw_time
+	// has to be advanced by the OCR1A it matched with
+	if(BITSET(TIFR1, OCF1A))
+		return;
+
+	uint16_t ocr = TCNT1 + sw_sched_ct;
+	OCR1A = ocr;
+
+	// the counter passed the new value before it was written, move it ahead
+	// again instead of letting the counter run until it wraps
+	while(TCNT1 >= ocr && !BITSET(TIFR1, OCF1A))
+	{
+		ocr = TCNT1 + SW_SCHED_MIN_GUARD_CT;
+		OCR1A = ocr;
+	}
+}
+
+// check, number, publish and queue the packet in sw_buf[!sw_front]
+static inline void sw_packet_publish(void)
+{
+	uint8_t back = sw_front ^ 1;
+
+#if SW_PARITY_CHECK
+	// drop it before anybody sees it
+	if(!sw_parity_ok(&sw_buf[back].data))
+	{
+		sw_stats.parity_errors++;
+		return;
+	}
+#endif
+
+	sw_stats.accepted++;
+
+	// unpack it once for all readers
+	sw_decode(&sw_buf[back].data, &sw_buf[back].state);
+
+	// number the packet
+	if(++sw_seq == 0)
+		sw_seq = 1;
+
+	sw_buf[back].seq = sw_seq;
+	sw_buf[back].time = sw_now_isr();
+
+	// publish it
+	sw_front = back;
+	sw_pubcnt++;
+
+	// queue it
+	sw_ring_push(&sw_buf[back]);
+
+	// show state on output port
+	SETBIT(SW_RCVINDI_PORT, SW_RCVINDI_P);
+
+	// send a callback that the data is become valid now
+	sw_data_is_now_valid();
+}
+
+// a complete packet has been received
+static inline void sw_packet_complete(void)
+{
+	sw_frame_complete();
+	sw_packet_publish();
+}
+
+#if SW_BURST
+// the clock-line stayed quiet, the burst is complete
+// also called when the burst-storage ran full
+static inline void sw_burst_end(void)
+{
+	uint8_t back = sw_burst_front ^ 1;
+
+#if SW_SAMPLE_EDGE != SW_EDGE_RISING
+	// the clock stays high after the last bit, only its rising edge was seen
+	if(sw_edge == SW_NEXT_FALL && sw_bitcnt < SW_FRAME_BITS)
+	{
+		if(sw_votes != 0 && sw_votes != SW_SAMPLE_VOTES)
+			sw_stats.noisy_bits++;
+
+		if(2 * sw_votes > SW_SAMPLE_VOTES)
+			sw_set_bit();
+
+		sw_bitcnt++;
+	}
+	sw_edge = SW_NEXT_LEAD;
+#endif
+
+	uint8_t bits = sw_capture_bits();
+
+	// also when the burst-storage ran full
+	if(bits > SW_BURST_MAX_DEVICES * 64)
+		sw_stats.overlong_frames++;
+
+	// no more edges until the next trigger
+	sw_capture_stop();
+	sw_frame_complete();
+
+	// number and publish the burst
+	if(++sw_burst_seq == 0)
+		sw_burst_seq = 1;
+
+	sw_burst_buf[back].bits = bits;
+	sw_burst_buf[back].seq = sw_burst_seq;
+	sw_burst_front = back;
+	sw_burst_pubcnt++;
+
+	// a single 48-bit packet also goes the regular way
+	if(bits == 48)
+	{
+		volatile sw_data_t *d = &sw_buf[sw_front ^ 1].data;
+
+		for(uint8_t i = 0; i < sizeof(d->bytes); i++)
+			d->bytes[i] = sw_burst_buf[back].bytes[i];
+
+		sw_packet_publish();
+	}
+}
+
+// Interrupt-Handler for the compare-match of timer 2
+// no edge for SW_BURST_GAP_CT ticks
+ISR(TIMER2_COMPA_vect)
+{
+	// the device did not start sending yet, keep waiting
+	if(!sw_capture_started())
+		return;
+
+	sw_burst_end();
+}
+#endif
+
+
+
+
+
+#if SW_CAPTURE_MODE == SW_CAPTURE_SPI
+
+// Interrupt-Handler for a byte shifted in by the SPI
+// 8 clock-edges of the device have passed since the last call, the byte has
+// to be fetched before the next one is complete (~120us at 66.6 kHz)
+ISR(SPI_STC_vect)
+{
+	uint8_t i = sw_bytecnt;
+
+	// another byte after a complete packet
+	// the spi stays enabled after the packet to see this
+	if(i == sizeof(sw_cap->bytes))
+	{
+		sw_stats.overlong_frames++;
+
+		// no more bytes until the next trigger
+		CLEARBIT(SPCR, SPE);
+		return;
+	}
+
+	sw_cap->bytes[i] = SPDR;
+
+	if(++i == sizeof(sw_cap->bytes))
+		sw_packet_complete();
+
+	sw_bytecnt = i;
+}
+
+#elif SW_CAPTURE_MODE == SW_CAPTURE_MULTI
+
+// a port received a complete packet
+static void sw_port_complete(uint8_t port)
+{
+	volatile sw_port_t *p = &sw_ports[port];
+	volatile sw_packet_t *pkt = &p->buf[p->front ^ 1];
+
+	p->done = 1;
+
+	// the last port to complete ends the frame
+	CLEARBIT(EIMSK, INT4 + port);
+	if(!(sw_multi_pending &= ~BIT(port)))
+		sw_frame_complete();
+
+#if SW_PARITY_CHECK
+	if(!sw_parity_ok(&pkt->data))
+	{
+		p->stats.parity_errors++;
+		return;
+	}
+#endif
+
+	p->stats.accepted++;
+
+	sw_decode(&pkt->data, &pkt->state);
+
+	if(++p->seq == 0)
+		p->seq = 1;
+
+	pkt->seq = p->seq;
+	pkt->time = sw_now_isr();
+	pkt->port = port;
+
+	p->front ^= 1;
+	p->pubcnt++;
+
+	sw_ring_push(pkt);
+
+	if(port == 0)
+	{
+		SETBIT(SW_RCVINDI_PORT, SW_RCVINDI_P);
+		sw_data_is_now_valid();
+	}
+}
+
+// capture a bit on a port
+// always inlined into the handler of each port, so all addresses are constant
+static inline void sw_port_edge(uint8_t port, uint8_t bit) __attribute__((always_inline));
+static inline void sw_port_edge(uint8_t port, uint8_t bit)
+{
+	volatile sw_port_t *p = &sw_ports[port];
+
+	if(bit)
+		*p->ptr |= p->mask;
+
+	if(!(p->mask <<= 1))
+	{
+		p->mask = BIT(0);
+		p->ptr++;
+	}
+
+	if(++p->bitcnt == 48)
+		sw_port_complete(port);
+}
+
+// Interrupt-Handlers for the clock-lines of the ports
+// the interrupt of a port is disabled as soon as its packet is complete
+ISR(INT4_vect)
+{
+	sw_port_edge(0, BITSET(SW_MULTI_PIN, 4));
+}
+
+#if SW_PORTS > 1
+ISR(INT5_vect)
+{
+	sw_port_edge(1, BITSET(SW_MULTI_PIN, 5));
+}
+#endif
+
+#if SW_PORTS > 2
+ISR(INT6_vect)
+{
+	sw_port_edge(2, BITSET(SW_MULTI_PIN, 6));
+}
+#endif
+
+#if SW_PORTS > 3
+ISR(INT7_vect)
+{
+	sw_port_edge(3, BITSET(SW_MULTI_PIN, 7));
+}
+#endif
+
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ANALYZER
+
+// Interrupt-Handler for an overflow of timer 5
+ISR(TIMER5_OVF_vect)
+{
+	sw_an_ovf++;
+}
+
+// Interrupt-Handler for the input-capture of timer 5
+// timestamps the edge, captures the bit and updates the statistics
+ISR(TIMER5_CAPT_vect)
+{
+	uint16_t t = ICR5;
+	uint8_t i = sw_bitcnt;
+
+#if SW_READY_EDGE
+	if(sw_timer_state == SW_TIMING_BUSY)
+	{
+		sw_ready_edge();
+		return;
+	}
+#endif
+
+	// an edge after the packet was complete, count the frame once
+	if(i >= 48)
+	{
+		if(i == 48)
+		{
+			sw_stats.overlong_frames++;
+			CLEARBIT(TIMSK5, ICIE5);
+		}
+		return;
+	}
+
+	SETBIT(SW_CLKINDI_PORT, SW_CLKINDI_P);
+	CLEARBIT(SW_CLKINDI_PORT, SW_CLKINDI_P);
+
+	if(BITSET(SW_DTA_PIN, SW_DTA_P))
+		sw_cap->bytes[i / 8] |= sw_an_mask;
+
+	sw_an_mask <<= 1;
+	if(!sw_an_mask)
+		sw_an_mask = BIT(0);
+
+	// 32-bit timestamp of this edge, the overflow may still be pending
+	uint16_t ovf = sw_an_ovf;
+	if(BITSET(TIFR5, TOV5) && t < 0x8000)
+		ovf++;
+
+	uint32_t t32 = ((uint32_t)ovf << 16) | t;
+
+	if(i == 0)
+	{
+		// gap to the last packet
+		if(sw_an_last_edge)
+		{
+			uint32_t gap = t32 - sw_an_last_edge;
+
+			sw_an_stats.gap_last = gap;
+			if(gap < sw_an_stats.gap_min) sw_an_stats.gap_min = gap;
+			if(gap > sw_an_stats.gap_max) sw_an_stats.gap_max = gap;
+		}
+	}
+	else
+	{
+		// period to the last edge
+		uint16_t period = t - sw_an_edges[i - 1];
+
+		if(period < sw_an_stats.period_min) sw_an_stats.period_min = period;
+		if(period > sw_an_stats.period_max) sw_an_stats.period_max = period;
+		sw_an_stats.period_sum += period;
+		sw_an_stats.period_cnt++;
+	}
+
+	sw_an_edges[i] = t;
+
+	if(++i == 48)
+	{
+		sw_an_last_edge = t32;
+		sw_an_stats.packets++;
+
+		sw_packet_complete();
+	}
+
+	sw_bitcnt = i;
+}
+
+#elif SW_CAPTURE_MODE == SW_CAPTURE_POLL
+
+// poll the clock-line and shift in the bits of a packet
+// returns the number of bits missing when a timeout expired, 0 on success
+//
+// The clock-line idles high, so the frame starts with a falling edge which
+// belongs to no bit. It is awaited first, within SW_POLL_START_US, and only
+// the rising edges after it are taken as bits.
+// Cycles per bit, from seeing the clock-line high to looking for it low again:
+//   bit inside a byte:               12 cycles
+//   last bit of a byte:              15 cycles
+// plus 3 from seeing it low to looking for it high again. Each wait-loop turn
+// takes 6 cycles, so an edge is seen up to 6 cycles late and each phase of the
+// clock has to last at least 6 cycles. All in all a bit needs 6 + 15 + 6 = 27
+// cycles, at 16 MHz the clock can run up to ~590 kHz. The data-line is read
+// 3-9 cycles after the rising edge.
+static inline uint8_t sw_poll_bits(volatile uint8_t *ptr) __attribute__((always_inline));
+static inline uint8_t sw_poll_bits(volatile uint8_t *ptr)
+{
+	uint8_t cnt = 48, mask = BIT(0), acc = 0;
+	uint16_t to = SW_POLL_US_TO_LOOPS(SW_POLL_START_US);
+
+	asm volatile(
+		// wait for the leading falling edge
+	"0:"
+		"sbis %[clkpin], %[clkp]"   "\n\t" // 2 if skipped, 1 if not
+		"rjmp 6f"                   "\n\t" // 2
+		"sbiw %[to], 1"             "\n\t" // 2
+		"brne 0b"                   "\n\t" // 2 if taken
+		"rjmp 4f"                   "\n\t"
+
+		// the frame started, the rising edges may follow closer
+	"6:"
+		"ldi  %A[to], lo8(%[edge])" "\n\t" // 1
+		"ldi  %B[to], hi8(%[edge])" "\n\t" // 1
+
+		// wait for the clock-line to go high
+	"1:"
+		"sbic %[clkpin], %[clkp]"   "\n\t" // 2 if skipped, 1 if not
+		"rjmp 2f"                   "\n\t" // 2
+		"sbiw %[to], 1"             "\n\t" // 2
+		"brne 1b"                   "\n\t" // 2 if taken
+		"rjmp 4f"                   "\n\t"
+
+		// rising edge, or the mask into the byte if the data-line is high
+	"2:"
+		"sbic %[dtapin], %[dtap]"   "\n\t" // 2 if skipped, 1 if not
+		"or   %[acc], %[mask]"      "\n\t" // 0 if skipped, 1 if not
+
+		// rotate the mask, store the byte when it is complete
+		"lsl  %[mask]"              "\n\t" // 1
+		"brne 3f"                   "\n\t" // 2 if taken, 1 if not
+		"st   %a[ptr]+, %[acc]"     "\n\t" // 2
+		"clr  %[acc]"               "\n\t" // 1
+		"inc  %[mask]"              "\n\t" // 1
+
+		// restart the timeout, count the bit
+	"3:"
+		"ldi  %A[to], lo8(%[edge])" "\n\t" // 1
+		"ldi  %B[to], hi8(%[edge])" "\n\t" // 1
+		"dec  %[cnt]"               "\n\t" // 1
+		"breq 4f"                   "\n\t" // 1 if not taken
+
+		// wait for the clock-line to go low again
+	"5:"
+		"sbis %[clkpin], %[clkp]"   "\n\t" // 2 if skipped, 1 if not
+		"rjmp 1b"                   "\n\t" // 2
+		"sbiw %[to], 1"             "\n\t" // 2
+		"brne 5b"                   "\n\t" // 2 if taken
+	"4:"
+		:
+		[cnt] "+r" (cnt),
+		[mask] "+r" (mask),
+		[acc] "+r" (acc),
+		[ptr] "+e" (ptr),
+		[to] "+w" (to)
+		:
+		[clkpin] "I" (_SFR_IO_ADDR(SW_CLK_PIN)),
+		[clkp] "I" (SW_CLK_P),
+		[dtapin] "I" (_SFR_IO_ADDR(SW_DTA_PIN)),
+		[dtap] "I" (SW_DTA_P),
+		[edge] "n" (SW_POLL_US_TO_LOOPS(SW_POLL_EDGE_US))
+		: "memory"
+	);
+
+	return cnt;
+}
+
+// read a packet, called from ISR(TIMER1_COMPA_vect) right after the release.
+// Edges after the 48th bit are not looked for, so overlong frames are not
+// counted in this mode
+static void sw_poll_capture(void)
+{
+	sw_bitcnt = 48 - sw_poll_bits(sw_cap_bytes);
+
+	if(sw_bitcnt == 48)
+		sw_packet_complete();
+}
+
+#elif SW_CAPTURE_MODE == SW_CAPTURE_ASM
+
+// Completion-Handler of the naked capture routine. It is entered with a jmp
+// from ISR(INT5_vect) below after that has restored all registers, so it
+// behaves like a regular Interrupt-Handler with a full gcc prologue/epilogue
+// and returns to the interrupted code with its reti.
+void sw_asm_complete(void) __asm__("__vector_sw_asm_complete") __attribute__((signal, used, externally_visible));
+void sw_asm_complete(void)
+{
+#if SW_READY_EDGE
+	if(sw_timer_state == SW_TIMING_BUSY)
+	{
+		sw_ready_edge();
+		return;
+	}
+#endif
+
+#if SW_BURST
+	// the burst-storage ran full
+	sw_burst_end();
+	return;
+#endif
+
+	// an edge after the packet was complete, INT5 stays disabled until the next trigger
+	if(sw_frame_done)
+	{
+		sw_stats.overlong_frames++;
+		return;
+	}
+
+	sw_packet_complete();
+
+	// point the handler to the sink to see further edges
+	sw_asm_ptr = &sw_asm_sink;
+	sw_asm_mask = BIT(7);
+	sw_asm_end = (uint8_t)(uint16_t)(&sw_asm_sink + 1);
+	SETBIT(EIMSK, INT5);
+}
+
+// Interrupt-Handler for external Interrupt INT5, naked version
+//
+// Cycle budget per edge, including the interrupt response (5), the jmp in the
+// vector table (3) and the reti (5):
+//   bit inside a byte:               46 cycles
+//   last bit of a byte:              51 cycles
+//   last bit of the packet:          52 cycles + sw_asm_complete()
+// With SW_BURST, restarting the end-of-burst timeout adds 3 cycles to each.
+// Both branches of the data-test take the same number of cycles, so the cost
+// does not depend on the received data. At 16 MHz the worst case of 51 cycles
+// leaves ~190 of the ~240 cycles per Device-Clock-Cycle to other interrupts.
+ISR(INT5_vect, ISR_NAKED)
+{
+	asm volatile(
+		"push r24"                  "\n\t" // 2
+		"in   r24, __SREG__"        "\n\t" // 1
+		"push r24"                  "\n\t" // 2
+		"push r30"                  "\n\t" // 2
+		"push r31"                  "\n\t" // 2
+
+#if SW_BURST
+		// restart the end-of-burst timeout
+		"clr  r24"                  "\n\t" // 1
+		"sts  %[tcnt2], r24"        "\n\t" // 2
+#endif
+
+		// pulse the CLKINDI-Pin by writing its bit to the PIN-Register twice
+		"ldi  r24, %[indi]"         "\n\t" // 1
+		"sts  %[indipin], r24"      "\n\t" // 2
+		"sts  %[indipin], r24"      "\n\t" // 2
+
+		// load the current byte and or the mask into it if the data-line is high
+		"movw r30, r2"              "\n\t" // 1
+		"ld   r24, Z"               "\n\t" // 2
+		"sbic %[dtapin], %[dtap]"   "\n\t" // 2 if skipped, 1 if not
+		"or   r24, r4"              "\n\t" // 0 if skipped, 1 if not
+		"st   Z, r24"               "\n\t" // 2
+
+		// rotate the mask, the carry signals a complete byte
+		"lsl  r4"                   "\n\t" // 1
+		"brcc 1f"                   "\n\t" // 2 if taken, 1 if not
+		"inc  r4"                   "\n\t" // 1
+		"adiw r30, 1"               "\n\t" // 2
+		"movw r2, r30"              "\n\t" // 1
+		"cp   r30, r5"              "\n\t" // 1
+		"breq 2f"                   "\n\t" // 2 if taken, 1 if not
+
+	"1:"
+		"pop  r31"                  "\n\t" // 2
+		"pop  r30"                  "\n\t" // 2
+		"pop  r24"                  "\n\t" // 2
+		"out  __SREG__, r24"        "\n\t" // 1
+		"pop  r24"                  "\n\t" // 2
+		"reti"                      "\n\t" // 5
+
+		// packet complete: no more edges until the next trigger,
+		// restore the registers and continue in the C completion-handler
+	"2:"
+		"cbi  %[eimsk], %[intbit]"  "\n\t" // 2
+		"pop  r31"                  "\n\t" // 2
+		"pop  r30"                  "\n\t" // 2
+		"pop  r24"                  "\n\t" // 2
+		"out  __SREG__, r24"        "\n\t" // 1
+		"pop  r24"                  "\n\t" // 2
+		"jmp  __vector_sw_asm_complete" "\n\t" // 3
+		::
+		[indi] "M" (BIT(SW_CLKINDI_P)),
+		[indipin] "n" (_SFR_MEM_ADDR(SW_CLKINDI_PIN)),
+		[dtapin] "I" (_SFR_IO_ADDR(SW_DTA_PIN)),
+		[dtap] "I" (SW_DTA_P),
+		[eimsk] "I" (_SFR_IO_ADDR(EIMSK)),
+		[intbit] "I" (INT5),
+		[tcnt2] "n" (_SFR_MEM_ADDR(TCNT2))
+	);
+}
+
+#else
+
+// read the data-line SW_SAMPLE_VOTES times
+// returns the number of reads which were high
+static inline uint8_t sw_sample(void) __attribute__((always_inline));
+static inline uint8_t sw_sample(void)
+{
+	uint8_t high = 0;
+
+	for(uint8_t i = 0; i < SW_SAMPLE_VOTES; i++)
+	{
+		if(BITSET(SW_DTA_PIN, SW_DTA_P))
+			high++;
+	}
+
+	return high;
+}
+
+// Interrupt-Handler for external Interrupt INT5
+ISR(INT5_vect)
+{
+
+	// packet complete or waiting for the ready-edge
+	if(sw_bitcnt >= SW_FRAME_BITS)
+	{
+#if SW_READY_EDGE
+		if(sw_bitcnt == SW_BITCNT_READY)
+			sw_ready_edge();
+		else
+#endif
+		// an edge after the packet was complete, count the frame once
+		if(sw_bitcnt == SW_FRAME_BITS)
+		{
+			sw_stats.overlong_frames++;
+			sw_bitcnt = SW_FRAME_BITS + 1;
+		}
+		return;
+	}
+
+#if SW_BURST
+	// restart the end-of-burst timeout
+	TCNT2 = 0;
+#endif
+
+	SETBIT(SW_CLKINDI_PORT, SW_CLKINDI_P);
+	CLEARBIT(SW_CLKINDI_PORT, SW_CLKINDI_P);
+
+	// this is slower -in fact it is too slow to keep up with the clock-
+	// because of the (pricy) relative bitshift required to generate the
+	// mask, as the avr only implements a 1-bit shift-operation.
+	// so to create a mask shifted by 48 bits, the avr loops 48 times,
+	// shifting the bit by one position.
+	/*
+	if(BITSET(SW_DTA_PIN, SW_DTA_P))
+		SETBIT(sw_cap->bits, sw_bitcnt);
+	*/
+
+
+#if SW_SAMPLE_EDGE != SW_EDGE_RISING
+	// the kind of an edge follows from the ones before it, reading the
+	// clock-line here would be too late with some interrupt latency
+	uint8_t high, late = 0, reads = SW_SAMPLE_VOTES;
+
+	// the leading falling edge of the frame
+	if(sw_edge == SW_NEXT_LEAD)
+	{
+		sw_edge = SW_NEXT_RISE;
+		return;
+	}
+
+	if(sw_edge == SW_NEXT_RISE)
+	{
+		// keep the reads for the falling edge, which decides the bit
+		sw_votes = sw_sample();
+		sw_edge = SW_NEXT_FALL;
+
+#if !SW_BURST
+		// except for the last one, which has no falling edge
+		if(sw_bitcnt != SW_FRAME_BITS - 1)
+#endif
+			return;
+
+		high = sw_votes;
+	}
+	else
+	{
+		late = sw_sample();
+		sw_edge = SW_NEXT_RISE;
+
+#if SW_SAMPLE_EDGE == SW_EDGE_BOTH
+		high = sw_votes + late;
+		reads = 2 * SW_SAMPLE_VOTES;
+#else
+		high = late;
+#endif
+	}
+
+	if(high != 0 && high != reads)
+		sw_stats.noisy_bits++;
+
+	if(2 * high > reads || (2 * high == reads && 2 * late > SW_SAMPLE_VOTES))
+#elif SW_SAMPLE_VOTES > 1
+	uint8_t high = sw_sample();
+
+	if(high != 0 && high != SW_SAMPLE_VOTES)
+		sw_stats.noisy_bits++;
+
+	if(2 * high > SW_SAMPLE_VOTES)
+#else
+	if(BITSET(SW_DTA_PIN, SW_DTA_P))
+#endif
+		sw_set_bit();
+
+#if SW_BURST
+	// the burst-storage ran full
+	if(++sw_bitcnt == SW_FRAME_BITS)
+		sw_burst_end();
+#else
+	if(++sw_bitcnt == 48)
+		sw_packet_complete();
+#endif
+}
+
+#endif
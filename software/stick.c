@@ -0,0 +1,252 @@
+// stick.c - fixed-point processing of the axes for flight control
+//
+// Each decoded packet is passed through a pipeline per axis:
+//   calibration: the raw value is offset by its center and scaled to
+//                +-STICK_FULL, separately on each side of the center
+//   deadzone:    values within the deadzone around the center read as 0,
+//                the rest is stretched to reach +-STICK_FULL again
+//   curve:       an exponential response curve from a PROGMEM table,
+//                interpolated linearly between its points
+//   filter:      none, a low-pass or a median of the last 3 values
+//
+// All divisions are done by the stick_set_*() functions, the pipeline itself
+// only multiplies, shifts and compares and does the same work for every packet.
+// Switching a curve or filter only changes an index, no table is recomputed.
+
+
+
+// value of a full deflection
+#define STICK_FULL 1024
+
+// the axes
+#define STICK_X 0
+#define STICK_Y 1
+#define STICK_M 2
+#define STICK_R 3
+#define STICK_AXES 4
+
+// the filters
+#define STICK_FILTER_NONE 0
+#define STICK_FILTER_LOWPASS 1
+#define STICK_FILTER_MEDIAN 2
+
+// the response curves, STICK_CURVE_EXPO_n blends n percent of x^3 into x
+#define STICK_CURVE_LINEAR 0
+#define STICK_CURVE_EXPO_25 1
+#define STICK_CURVE_EXPO_50 2
+#define STICK_CURVE_EXPO_75 3
+#define STICK_CURVE_EXPO_100 4
+#define STICK_CURVES 5
+
+// the curves have a point every 32 units of 0..STICK_FULL
+#define STICK_CURVE_SHIFT 5
+#define STICK_CURVE_POINTS ((STICK_FULL >> STICK_CURVE_SHIFT) + 1)
+
+// one point of a curve: (1-e)*x + e*x^3, with x and e scaled by STICK_FULL
+#define STICK_EXPO(e, i) \
+	(uint16_t)((((uint32_t)(STICK_FULL - (e)) * ((i) * 32) + \
+	(e) * (((uint32_t)((i) * 32) * ((i) * 32) / STICK_FULL) * ((i) * 32) / STICK_FULL)) / STICK_FULL))
+
+#define STICK_EXPO_TAB(e) { \
+	STICK_EXPO(e,  0), STICK_EXPO(e,  1), STICK_EXPO(e,  2), STICK_EXPO(e,  3), \
+	STICK_EXPO(e,  4), STICK_EXPO(e,  5), STICK_EXPO(e,  6), STICK_EXPO(e,  7), \
+	STICK_EXPO(e,  8), STICK_EXPO(e,  9), STICK_EXPO(e, 10), STICK_EXPO(e, 11), \
+	STICK_EXPO(e, 12), STICK_EXPO(e, 13), STICK_EXPO(e, 14), STICK_EXPO(e, 15), \
+	STICK_EXPO(e, 16), STICK_EXPO(e, 17), STICK_EXPO(e, 18), STICK_EXPO(e, 19), \
+	STICK_EXPO(e, 20), STICK_EXPO(e, 21), STICK_EXPO(e, 22), STICK_EXPO(e, 23), \
+	STICK_EXPO(e, 24), STICK_EXPO(e, 25), STICK_EXPO(e, 26), STICK_EXPO(e, 27), \
+	STICK_EXPO(e, 28), STICK_EXPO(e, 29), STICK_EXPO(e, 30), STICK_EXPO(e, 31), \
+	STICK_EXPO(e, 32) }
+
+// computed by the compiler
+static const uint16_t stick_curves[STICK_CURVES][STICK_CURVE_POINTS] PROGMEM = {
+	STICK_EXPO_TAB(0),
+	STICK_EXPO_TAB(256),
+	STICK_EXPO_TAB(512),
+	STICK_EXPO_TAB(768),
+	STICK_EXPO_TAB(1024)
+};
+
+// configuration and state of an axis
+typedef struct
+{
+	// calibration: raw center and scales of both sides in 1/256
+	uint16_t center;
+	uint16_t scale_neg;
+	uint16_t scale_pos;
+
+	// deadzone in units of STICK_FULL and the scale to stretch the rest in 1/256
+	uint16_t dz;
+	uint16_t dz_scale;
+
+	// STICK_CURVE_*
+	uint8_t curve;
+
+	// STICK_FILTER_* and the strength of the low-pass (new value weighs 1/2^n)
+	uint8_t filter;
+	uint8_t lp_shift;
+
+	// low-pass state in 1/16, the last two values for the median
+	int16_t lp;
+	int16_t hist[2];
+} stick_axis_t;
+
+stick_axis_t stick_axes[STICK_AXES];             // 76 bytes ram
+
+
+
+
+
+// scale of a range to STICK_FULL in 1/256
+// the range has to be at least 5 to fit 16 bits
+static uint16_t stick_scale(uint16_t range)
+{
+	if(range < 5)
+		range = 5;
+
+	return ((uint32_t)STICK_FULL << 8) / range;
+}
+
+// set the raw values of both end-stops and the center of an axis
+void stick_set_cal(uint8_t axis, uint16_t min, uint16_t center, uint16_t max)
+{
+	stick_axis_t *a = &stick_axes[axis];
+
+	a->center = center;
+	a->scale_neg = stick_scale(center - min);
+	a->scale_pos = stick_scale(max - center);
+}
+
+// set the deadzone of an axis in units of STICK_FULL
+void stick_set_deadzone(uint8_t axis, uint16_t dz)
+{
+	stick_axis_t *a = &stick_axes[axis];
+
+	if(dz > STICK_FULL - 5)
+		dz = STICK_FULL - 5;
+
+	a->dz = dz;
+	a->dz_scale = stick_scale(STICK_FULL - dz);
+}
+
+// select the response curve of an axis
+void stick_set_curve(uint8_t axis, uint8_t curve)
+{
+	if(curve < STICK_CURVES)
+		stick_axes[axis].curve = curve;
+}
+
+// select the filter of an axis
+// with STICK_FILTER_LOWPASS each new value weighs 1/2^shift
+void stick_set_filter(uint8_t axis, uint8_t filter, uint8_t shift)
+{
+	stick_axis_t *a = &stick_axes[axis];
+
+	a->filter = filter;
+	a->lp_shift = shift;
+}
+
+// the full range of each axis as sent by the device, no deadzone,
+// linear response and no filter
+void stick_setup(void)
+{
+	stick_set_cal(STICK_X, 0, 512, 1023);
+	stick_set_cal(STICK_Y, 0, 512, 1023);
+	stick_set_cal(STICK_M, 0, 64, 127);
+	stick_set_cal(STICK_R, 0, 32, 63);
+
+	for(uint8_t i = 0; i < STICK_AXES; i++)
+	{
+		stick_set_deadzone(i, 0);
+		stick_set_curve(i, STICK_CURVE_LINEAR);
+		stick_set_filter(i, STICK_FILTER_NONE, 0);
+	}
+}
+
+// median of three values
+static inline int16_t stick_median(int16_t a, int16_t b, int16_t c)
+{
+	if(a > b)
+	{
+		int16_t t = a;
+		a = b;
+		b = t;
+	}
+
+	// a <= b now
+	if(c <= a)
+		return a;
+
+	if(c >= b)
+		return b;
+
+	return c;
+}
+
+// run a raw value through the pipeline of an axis
+static int16_t stick_axis(stick_axis_t *a, uint16_t raw)
+{
+	uint16_t mag;
+	uint8_t neg = raw < a->center;
+
+	// calibration
+	if(neg)
+		mag = ((uint32_t)(a->center - raw) * a->scale_neg) >> 8;
+	else
+		mag = ((uint32_t)(raw - a->center) * a->scale_pos) >> 8;
+
+	if(mag > STICK_FULL)
+		mag = STICK_FULL;
+
+	// deadzone
+	if(mag <= a->dz)
+		mag = 0;
+	else if(a->dz > 0)
+	{
+		mag = ((uint32_t)(mag - a->dz) * a->dz_scale) >> 8;
+
+		if(mag > STICK_FULL)
+			mag = STICK_FULL;
+	}
+
+	// response curve, linear interpolation between two points
+	const uint16_t *curve = stick_curves[a->curve];
+	uint8_t idx = mag >> STICK_CURVE_SHIFT;
+	uint8_t frac = mag & ((1 << STICK_CURVE_SHIFT) - 1);
+
+	mag = pgm_read_word(&curve[idx]);
+	if(frac)
+		mag += ((pgm_read_word(&curve[idx + 1]) - mag) * frac) >> STICK_CURVE_SHIFT;
+
+	int16_t v = neg ? -(int16_t)mag : (int16_t)mag;
+
+	// filter
+	switch(a->filter)
+	{
+		case STICK_FILTER_LOWPASS:
+			a->lp += ((int32_t)v * 16 - a->lp) >> a->lp_shift;
+			v = a->lp >> 4;
+			break;
+
+		case STICK_FILTER_MEDIAN:
+		{
+			int16_t m = stick_median(a->hist[0], a->hist[1], v);
+			a->hist[0] = a->hist[1];
+			a->hist[1] = v;
+			v = m;
+			break;
+		}
+	}
+
+	return v;
+}
+
+// run a decoded packet through the pipeline, out receives STICK_AXES values
+// of +-STICK_FULL. Has to be called for every packet, as the filters keep state
+void stick_process(const sw_state_t *st, int16_t *out)
+{
+	out[STICK_X] = stick_axis(&stick_axes[STICK_X], st->x);
+	out[STICK_Y] = stick_axis(&stick_axes[STICK_Y], st->y);
+	out[STICK_M] = stick_axis(&stick_axes[STICK_M], st->m);
+	out[STICK_R] = stick_axis(&stick_axes[STICK_R], st->r);
+}